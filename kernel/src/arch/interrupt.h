@@ -9,4 +9,9 @@ void arch_interrupt_set_ipl(ipl_t ipl);
 /**
  * @brief Get the IPL level
  */
-ipl_t arch_interrupt_get_ipl();
\ No newline at end of file
+ipl_t arch_interrupt_get_ipl();
+
+/**
+ * @brief Check if interrupts are enabled on the current CPU
+ */
+bool arch_interrupt_enabled();
\ No newline at end of file
@@ -18,8 +18,15 @@ uintptr_t arch_sched_stack_setup(process_t *proc, char **argv, char **envp, auxv
  * @brief Creates a new userspace thread
  * @param ip essentially the entry point
  * @param sp userspace stack pointer
+ * @param tls thread local storage pointer
  */
-thread_t *arch_sched_thread_create_user(process_t *proc, uintptr_t ip, uintptr_t sp);
+thread_t *arch_sched_thread_create_user(process_t *proc, uintptr_t ip, uintptr_t sp, uintptr_t tls);
+
+/**
+ * @brief Creates a copy of the current userspace thread in another process
+ * @warning Only intended to be used within syscall handlers, the new thread returns 0 from the syscall
+ */
+thread_t *arch_sched_thread_fork(process_t *proc);
 
 /**
  * @brief Creates a new kernel thread
@@ -27,6 +34,16 @@ thread_t *arch_sched_thread_create_user(process_t *proc, uintptr_t ip, uintptr_t
  */
 thread_t *arch_sched_thread_create_kernel(void (* func)());
 
+/**
+ * @brief Give up the CPU to the next thread, blocks if the current thread is blocking
+ */
+void arch_sched_yield();
+
+/**
+ * @brief Interrupt a CPU so that it makes a new scheduling decision
+ */
+void arch_sched_preempt(cpu_t *cpu);
+
 /**
  * @brief Returns the active thread on the current CPU
  */
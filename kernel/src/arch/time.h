@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * @brief Read a high resolution counter, used for CPU time accounting
+ * @warning Only differences between reads on the same CPU are meaningful
+ * @returns counter in nanoseconds
+ */
+uint64_t arch_time_counter();
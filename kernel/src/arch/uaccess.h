@@ -0,0 +1,16 @@
+#pragma once
+#include <stddef.h>
+
+/**
+ * @brief Copy a buffer to userspace of the active address space
+ * @warning Caller is responsible for ensuring that the destination lies in userspace
+ * @returns bytes copied, less than count if a fault could not be resolved
+ */
+size_t arch_uaccess_copy_to(void *dest, void *src, size_t count);
+
+/**
+ * @brief Copy a buffer from userspace of the active address space
+ * @warning Caller is responsible for ensuring that the source lies in userspace
+ * @returns bytes copied, less than count if a fault could not be resolved
+ */
+size_t arch_uaccess_copy_from(void *dest, void *src, size_t count);
\ No newline at end of file
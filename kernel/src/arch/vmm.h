@@ -12,6 +12,12 @@
  */
 vmm_address_space_t *arch_vmm_address_space_create();
 
+/**
+ * @brief Free the page tables of an address space along with the address space itself
+ * @warning Pages still mapped are not released, the address space must not be loaded on any CPU
+ */
+void arch_vmm_address_space_destroy(vmm_address_space_t *address_space);
+
 /**
  * @brief Load a virtual address space
  */
@@ -22,6 +28,17 @@ void arch_vmm_load_address_space(vmm_address_space_t *address_space);
  */
 void arch_vmm_ptm_map(vmm_address_space_t *address_space, uintptr_t vaddr, uintptr_t paddr, vmm_protection_t prot, vmm_cache_t cache, int flags);
 
+/**
+ * @brief Change the protection of every mapped page in a range
+ * @warning Does not invalidate the TLB, batch changes and follow up with `arch_vmm_tlb_shootdown`
+ */
+void arch_vmm_ptm_protect(vmm_address_space_t *address_space, uintptr_t vaddr, size_t length, vmm_protection_t prot, vmm_cache_t cache, int flags);
+
+/**
+ * @brief Invalidate the TLB of an address space on every CPU
+ */
+void arch_vmm_tlb_shootdown(vmm_address_space_t *address_space);
+
 /**
  * @brief Unmap a virtual address from address space
  */
@@ -21,6 +21,7 @@
 #include <fs/tmpfs.h>
 #include <fs/rdsk.h>
 #include <fs/stdio.h>
+#include <fs/schedfs.h>
 #include <sched/sched.h>
 #include <sched/resource.h>
 #include <graphics/draw.h>
@@ -36,6 +37,7 @@
 #include <arch/x86_64/vmm.h>
 #include <arch/x86_64/interrupt.h>
 #include <arch/x86_64/exception.h>
+#include <arch/x86_64/uaccess.h>
 #include <arch/x86_64/sched.h>
 #include <arch/x86_64/sys/tss.h>
 #include <arch/x86_64/sys/gdt.h>
@@ -45,6 +47,7 @@
 #include <arch/x86_64/sys/cpu.h>
 #include <arch/x86_64/sys/cpuid.h>
 #include <arch/x86_64/sys/lapic.h>
+#include <arch/x86_64/sys/tsc.h>
 #include <arch/x86_64/syscall.h>
 #include <arch/x86_64/dev/pit.h>
 #include <arch/x86_64/dev/ps2.h>
@@ -53,6 +56,9 @@
 #include <arch/x86_64/dev/pic8259.h>
 
 #define PIT_TIMER_FREQ 1000
+#define IRQ_STACK_SIZE_PG 4
+#define DOUBLE_FAULT_STACK_SIZE_PG 2
+#define NMI_STACK_SIZE_PG 2
 #define LAPIC_CALIBRATION_TICKS 0x10000
 #define ADJUST_STACK(OFFSET) asm volatile("mov %%rsp, %%rax\nadd %0, %%rax\nmov %%rax, %%rsp\nmov %%rbp, %%rax\nadd %0, %%rax\nmov %%rax, %%rbp" : : "rm" (OFFSET) : "rax", "memory")
 
@@ -71,6 +77,22 @@ static void log_raw_serial(char c) {
 	x86_64_port_outb(0x3F8, c);
 }
 
+static uintptr_t ist_stack_alloc(size_t page_count) {
+    pmm_page_t *page = pmm_alloc_pages(page_count, PMM_STANDARD);
+    return HHDM(page->paddr + page_count * ARCH_PAGE_SIZE);
+}
+
+static x86_64_tss_t *tss_create() {
+    x86_64_tss_t *tss = heap_alloc(sizeof(x86_64_tss_t));
+    memset(tss, 0, sizeof(x86_64_tss_t));
+    tss->iomap_base = sizeof(x86_64_tss_t);
+    x86_64_tss_set_ist(tss, X86_64_TSS_IST_IRQ, ist_stack_alloc(IRQ_STACK_SIZE_PG));
+    x86_64_tss_set_ist(tss, X86_64_TSS_IST_DOUBLE_FAULT, ist_stack_alloc(DOUBLE_FAULT_STACK_SIZE_PG));
+    x86_64_tss_set_ist(tss, X86_64_TSS_IST_NMI, ist_stack_alloc(NMI_STACK_SIZE_PG));
+    x86_64_gdt_load_tss(tss);
+    return tss;
+}
+
 static void format_lrs(char *fmt, ...) {
     va_list list;
 	va_start(list, fmt);
@@ -105,6 +127,7 @@ static void pit_time_handler([[maybe_unused]] x86_64_interrupt_frame_t *frame) {
 
 // TODO: A decent amount of duplicate code here. Consider having some sort of shared init.
 [[noreturn]] __attribute__((naked)) static void init_ap() {
+    x86_64_sched_placeholder_boot();
     log(LOG_LEVEL_INFO, "INIT", "Initializing AP %i", x86_64_lapic_id());
 
     x86_64_gdt_load();
@@ -118,8 +141,11 @@ static void pit_time_handler([[maybe_unused]] x86_64_interrupt_frame_t *frame) {
     uint64_t cr4;
     asm volatile("mov %%cr4, %0" : "=r" (cr4) : : "memory");
     cr4 |= 1 << 7; /* CR4.PGE */
+    if(x86_64_cpuid_feature(X86_64_CPUID_FEATURE_FSGSBASE)) cr4 |= 1 << 16; /* CR4.FSGSBASE */
     asm volatile("mov %0, %%cr4" : : "r" (cr4) : "memory");
 
+    x86_64_uaccess_init_cpu();
+
     ADJUST_STACK(g_hhdm_offset);
     arch_vmm_load_address_space(g_vmm_kernel_address_space);
 
@@ -129,10 +155,8 @@ static void pit_time_handler([[maybe_unused]] x86_64_interrupt_frame_t *frame) {
     x86_64_interrupt_load_idt();
 
     // CPU Local
-    x86_64_tss_t *tss = heap_alloc(sizeof(x86_64_tss_t));
-    memset(tss, 0, sizeof(x86_64_tss_t));
-    tss->iomap_base = sizeof(x86_64_tss_t);
-    x86_64_gdt_load_tss(tss);
+    x86_64_sched_placeholder_load();
+    x86_64_tss_t *tss = tss_create();
 
     x86_64_pit_set_reload(UINT16_MAX);
     uint16_t start_count = x86_64_pit_count();
@@ -143,8 +167,12 @@ static void pit_time_handler([[maybe_unused]] x86_64_interrupt_frame_t *frame) {
     cpu->lapic_id = x86_64_lapic_id();
     cpu->lapic_timer_frequency = (uint64_t) (LAPIC_CALIBRATION_TICKS / (start_count - end_count)) * PIT_FREQ;
     cpu->tss = tss;
-    cpu->tlb_shootdown_check = SPINLOCK_INIT;
+    cpu->tlb_shootdown_pending = false;
     cpu->tlb_shootdown_lock = SPINLOCK_INIT;
+    cpu->fpu_owner = NULL;
+    cpu->fpu_enabled = true;
+    cpu->stack_cache.count = 0;
+    cpu->idle_state = X86_64_CPU_IDLE_RUNNING;
 
     // Misc
     x86_64_fpu_init_cpu();
@@ -169,6 +197,8 @@ void x86_64_init_stage_set(x86_64_init_stage_t stage) {
 }
 
 [[noreturn]] void init(tartarus_boot_info_t *boot_info) {
+    x86_64_sched_placeholder_boot();
+
 	g_hhdm_offset = boot_info->hhdm.offset;
 	g_hhdm_size = boot_info->hhdm.size;
 
@@ -246,8 +276,11 @@ void x86_64_init_stage_set(x86_64_init_stage_t stage) {
     uint64_t cr4;
     asm volatile("mov %%cr4, %0" : "=r" (cr4) : : "memory");
     cr4 |= 1 << 7; /* CR4.PGE */
+    if(x86_64_cpuid_feature(X86_64_CPUID_FEATURE_FSGSBASE)) cr4 |= 1 << 16; /* CR4.FSGSBASE */
     asm volatile("mov %0, %%cr4" : : "r" (cr4) : "memory");
 
+    x86_64_uaccess_init_cpu();
+
     g_vmm_kernel_address_space = x86_64_vmm_init();
 
     g_hhdm_segment.address_space = g_vmm_kernel_address_space;
@@ -267,6 +300,8 @@ void x86_64_init_stage_set(x86_64_init_stage_t stage) {
     g_kernel_segment.type = VMM_SEGMENT_TYPE_ANON;
     list_append(&g_vmm_kernel_address_space->segments, &g_kernel_segment.list_elem);
 
+    vmm_kernel_arena_init();
+
     ADJUST_STACK(g_hhdm_offset);
     arch_vmm_load_address_space(g_vmm_kernel_address_space);
 
@@ -286,8 +321,8 @@ void x86_64_init_stage_set(x86_64_init_stage_t stage) {
     log(LOG_LEVEL_DEBUG, "HEAP", "randomly allocated memory (0x500 bytes): %#lx", (uintptr_t) heap_random_address);
 
     // Initialize FPU
-    x86_64_fpu_init();
     x86_64_fpu_init_cpu();
+    x86_64_fpu_init();
 
     // Initialize ACPI
     acpi_initialize(boot_info->acpi_rsdp);
@@ -345,6 +380,12 @@ void x86_64_init_stage_set(x86_64_init_stage_t stage) {
     r = vfs_mount(&g_stdio_ops, "/tmp/stdio", NULL);
     if(r != 0) panic("Failed to mount /tmp/stdio (%i)", r);
 
+    vfs_node_t *sched_dir;
+    r = vfs_mkdir("/tmp", "sched", &sched_dir, NULL);
+    if(r != 0) panic("Failed to mkdir /tmp/sched (%i)", r);
+    r = vfs_mount(&g_schedfs_ops, "/tmp/sched", NULL);
+    if(r != 0) panic("Failed to mount /tmp/sched (%i)", r);
+
     vfs_node_t *stdin, *stdout, *stderr;
     r = vfs_lookup("/tmp/stdio/stdin", &stdin, NULL);
     if(r != 0) panic("Failed to lookup /tmp/stdio/stdin (%i)", r);
@@ -416,7 +457,7 @@ void x86_64_init_stage_set(x86_64_init_stage_t stage) {
         resource_create_at(&proc->resource_table, 2, stderr, 0, RESOURCE_MODE_READ_WRITE, true);
 
         uintptr_t thread_stack = arch_sched_stack_setup(proc, argv, envp, &auxv);
-        thread_t *thread = arch_sched_thread_create_user(proc, interpreter ? interp_auxv.entry : auxv.entry, thread_stack);
+        thread_t *thread = arch_sched_thread_create_user(proc, interpreter ? interp_auxv.entry : auxv.entry, thread_stack, 0);
         log(LOG_LEVEL_DEBUG, "INIT", "init thread >> entry: %#lx, stack: %#lx", interpreter ? interp_auxv.entry : auxv.entry, thread_stack);
         sched_thread_schedule(thread);
     }
@@ -424,15 +465,21 @@ void x86_64_init_stage_set(x86_64_init_stage_t stage) {
     // SMP init
     g_x86_64_cpus = heap_alloc(sizeof(x86_64_cpu_t) * boot_info->cpu_count);
 
-    x86_64_tss_t *tss = heap_alloc(sizeof(x86_64_tss_t));
-    memset(tss, 0, sizeof(x86_64_tss_t));
-    tss->iomap_base = sizeof(x86_64_tss_t);
-    x86_64_gdt_load_tss(tss);
+    // The boot placeholder is left to the APs, each runs on it until it can allocate its own
+    x86_64_sched_placeholder_load();
+    x86_64_tss_t *tss = tss_create();
+
+    // A kernel stack overflow double faults while pushing the page fault frame onto the guard page
+    x86_64_interrupt_set_ist(0x8, X86_64_TSS_IST_DOUBLE_FAULT);
+    x86_64_interrupt_set_ist(0x2, X86_64_TSS_IST_NMI);
 
     x86_64_pit_set_reload(UINT16_MAX);
     uint16_t start_count = x86_64_pit_count();
+    uint64_t start_tsc = x86_64_tsc_read();
     x86_64_lapic_timer_poll(LAPIC_CALIBRATION_TICKS);
+    uint64_t end_tsc = x86_64_tsc_read();
     uint16_t end_count = x86_64_pit_count();
+    x86_64_tsc_init((end_tsc - start_tsc) * PIT_FREQ / (uint16_t) (start_count - end_count));
 
     x86_64_cpu_t *cpu = NULL;
 
@@ -445,8 +492,12 @@ void x86_64_init_stage_set(x86_64_init_stage_t stage) {
             cpu->lapic_id = x86_64_lapic_id();
             cpu->lapic_timer_frequency = (uint64_t) (LAPIC_CALIBRATION_TICKS / (start_count - end_count)) * PIT_FREQ;
             cpu->tss = tss;
-            cpu->tlb_shootdown_check = SPINLOCK_INIT;
+            cpu->tlb_shootdown_pending = false;
             cpu->tlb_shootdown_lock = SPINLOCK_INIT;
+            cpu->fpu_owner = NULL;
+            cpu->fpu_enabled = true;
+            cpu->stack_cache.count = 0;
+            cpu->idle_state = X86_64_CPU_IDLE_RUNNING;
             g_x86_64_cpu_count++;
             continue;
         }
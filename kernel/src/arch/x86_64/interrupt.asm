@@ -1,4 +1,5 @@
 extern x86_64_interrupt_handler
+extern g_x86_64_uaccess_smap
 
 %macro SWAPGS_CONDITIONAL 0
         test qword [rsp + 24], 3
@@ -9,6 +10,10 @@ extern x86_64_interrupt_handler
 
 isr_stub:
     cld                                                     ; Clear direction flag
+    cmp byte [g_x86_64_uaccess_smap], 0                     ; Handlers run without user access, the frame keeps the interrupted AC for iretq
+    je .smap_done
+    clac
+    .smap_done:
 
     SWAPGS_CONDITIONAL
 
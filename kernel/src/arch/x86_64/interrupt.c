@@ -1,6 +1,8 @@
 #include "interrupt.h"
 #include <arch/interrupt.h>
+#include <common/spinlock.h>
 #include <arch/x86_64/sys/gdt.h>
+#include <arch/x86_64/sys/tss.h>
 
 #define FLAGS_NORMAL 0x8E
 #define FLAGS_TRAP 0x8F
@@ -44,7 +46,9 @@ static ipl_t g_interrupt_to_ipl_map[] = {
 extern uint64_t g_isr_stubs[IDT_SIZE];
 
 static idt_entry_t g_idt[IDT_SIZE];
+/* Entries are only ever claimed, never released, so the dispatch path reads them without a lock once published */
 static interrupt_entry_t g_entries[IDT_SIZE];
+static spinlock_t g_entries_lock = SPINLOCK_INIT; // Serializes claiming entries
 
 x86_64_interrupt_irq_eoi_t g_x86_64_interrupt_irq_eoi;
 
@@ -76,9 +80,15 @@ ipl_t arch_interrupt_get_ipl() {
     return g_interrupt_to_ipl_map[interrupt_priority_get()];
 }
 
+bool arch_interrupt_enabled() {
+    uint64_t rflags;
+    asm volatile("pushfq\npop %0" : "=r" (rflags));
+    return (rflags & (1 << 9)) != 0;
+}
+
 void x86_64_interrupt_handler(x86_64_interrupt_frame_t *frame) {
     if(frame->int_no >= 0x20) g_x86_64_interrupt_irq_eoi(frame->int_no);
-    if(!g_entries[frame->int_no].free) g_entries[frame->int_no].handler(frame);
+    if(!__atomic_load_n(&g_entries[frame->int_no].free, __ATOMIC_ACQUIRE)) g_entries[frame->int_no].handler(frame);
 }
 
 void x86_64_interrupt_init() {
@@ -95,17 +105,33 @@ void x86_64_interrupt_load_idt() {
     asm volatile("lidt %0" : : "m" (idtr));
 }
 
-void x86_64_interrupt_set(uint8_t vector, x86_64_interrupt_priority_t priority, x86_64_interrupt_handler_t handler) {
-    g_entries[vector].free = false;
+static void entry_publish(uint8_t vector, x86_64_interrupt_priority_t priority, x86_64_interrupt_handler_t handler) {
     g_entries[vector].handler = handler;
     g_entries[vector].priority = priority;
+    __atomic_store_n(&g_entries[vector].free, false, __ATOMIC_RELEASE);
+
+    // Handlers on the IRQ stack must not switch threads, the next interrupt would reuse the stack
+    if(vector >= 0x20) g_idt[vector].ist = priority == X86_64_INTERRUPT_PRIORITY_SCHED ? 0 : X86_64_TSS_IST_IRQ;
+}
+
+void x86_64_interrupt_set(uint8_t vector, x86_64_interrupt_priority_t priority, x86_64_interrupt_handler_t handler) {
+    spinlock_acquire(&g_entries_lock);
+    entry_publish(vector, priority, handler);
+    spinlock_release(&g_entries_lock);
+}
+
+void x86_64_interrupt_set_ist(uint8_t vector, uint8_t ist) {
+    g_idt[vector].ist = ist;
 }
 
 int x86_64_interrupt_request(x86_64_interrupt_priority_t priority, x86_64_interrupt_handler_t handler) {
+    spinlock_acquire(&g_entries_lock);
     for(int i = priority << 4; i < IDT_SIZE; i++) {
         if(!g_entries[i].free) continue;
-        x86_64_interrupt_set(i, priority, handler);
+        entry_publish(i, priority, handler);
+        spinlock_release(&g_entries_lock);
         return i;
     }
+    spinlock_release(&g_entries_lock);
     return -1;
 }
\ No newline at end of file
@@ -36,6 +36,7 @@ void x86_64_interrupt_load_idt();
 
 /**
  * @brief Set a handler onto an interrupt vector
+ * @note Device interrupts run on the per-CPU IRQ stack, except scheduler ones as they switch threads
  * @warning Will carelessly override existing handlers
  */
 void x86_64_interrupt_set(uint8_t vector, x86_64_interrupt_priority_t priority, x86_64_interrupt_handler_t handler);
@@ -45,3 +46,10 @@ void x86_64_interrupt_set(uint8_t vector, x86_64_interrupt_priority_t priority,
  * @return chosen interrupt vector, -1 on error
  */
 int x86_64_interrupt_request(x86_64_interrupt_priority_t priority, x86_64_interrupt_handler_t handler);
+
+/**
+ * @brief Run an interrupt vector on a dedicated stack from the TSS
+ * @param vector
+ * @param ist IST index, 0 to use the current stack
+ */
+void x86_64_interrupt_set_ist(uint8_t vector, uint8_t ist);
@@ -11,26 +11,34 @@
 #include <memory/hhdm.h>
 #include <sched/sched.h>
 #include <sched/thread.h>
+#include <sched/work.h>
+#include <sched/preempt.h>
+#include <sched/rcu.h>
+#include <sys/ipl.h>
 #include <arch/types.h>
 #include <arch/sched.h>
 #include <arch/vmm.h>
 #include <arch/cpu.h>
 #include <arch/x86_64/init.h>
 #include <arch/x86_64/interrupt.h>
+#include <arch/x86_64/syscall.h>
+#include <arch/x86_64/uaccess.h>
 #include <arch/x86_64/sys/tss.h>
 #include <arch/x86_64/sys/msr.h>
 #include <arch/x86_64/sys/fpu.h>
+#include <arch/x86_64/sys/cpuid.h>
 #include <arch/x86_64/sys/lapic.h>
 
-#define INTERVAL 100'000
-#define KERNEL_STACK_SIZE_PG 16
+#define KERNEL_STACK_SIZE_PG 4
 #define USER_STACK_SIZE (8 * ARCH_PAGE_SIZE)
+#define PREEMPT_RETRY_US 100
 
 #define X86_64_THREAD(THREAD) (CONTAINER_OF((THREAD), x86_64_thread_t, common))
 
 typedef struct {
     uintptr_t base;
     uintptr_t size;
+    bool guarded;
 } stack_t;
 
 typedef struct x86_64_thread {
@@ -39,7 +47,8 @@ typedef struct x86_64_thread {
     uintptr_t syscall_rsp;
     stack_t kernel_stack;
     struct {
-        void *fpu_area;
+        void *fpu_area; /* NULL for kernel threads, they never touch the FPU */
+        x86_64_cpu_t *fpu_cpu; /* cpu the state was last loaded on */
         uint64_t fs, gs;
     } state;
     thread_t common;
@@ -64,15 +73,33 @@ typedef struct {
     uint64_t user_stack;
 } __attribute__((packed)) init_stack_user_t;
 
+typedef struct {
+    uint64_t r12, r13, r14, r15, rbp, rbx;
+    void (* thread_init)(x86_64_thread_t *prev);
+    void (* thread_init_fork)();
+    x86_64_syscall_frame_t frame;
+} __attribute__((packed)) init_stack_fork_t;
+
 static_assert(offsetof(x86_64_thread_t, rsp) == 8, "rsp in thread_t changed. Update arch/x86_64/sched.asm::THREAD_RSP_OFFSET");
 static_assert(offsetof(x86_64_thread_t, syscall_rsp) == 16, "syscall_rsp in thread_t changed. Update arch/amd64/sched/syscall.asm::SYSCALL_RSP_OFFSET");
 static_assert(offsetof(x86_64_thread_t, kernel_stack) + offsetof(stack_t, base) == 24, "kernel_stack::base in thread_t changed. Update arch/x86_64/syscall.asm::KERNEL_STACK_BASE_OFFSET");
 
 extern x86_64_thread_t *x86_64_sched_context_switch(x86_64_thread_t *this, x86_64_thread_t *next);
 extern void x86_64_sched_userspace_init();
+extern void x86_64_syscall_fork_return();
+
+static x86_64_thread_t g_boot_placeholder = { .this = &g_boot_placeholder };
 
 static long g_next_tid = 1;
 static int g_sched_vector = 0;
+static bool g_fsgsbase = false;
+static bool g_mwait = false;
+
+static void timer_rearm(thread_t *current) {
+    uint64_t timeslice = sched_thread_timeslice(current);
+    if(timeslice == 0) return x86_64_lapic_timer_stop();
+    x86_64_lapic_timer_oneshot(g_sched_vector, MATH_DIV_CEIL(timeslice, 1'000));
+}
 
 /**
     @warning The prev parameter relies on the fact
@@ -83,15 +110,36 @@ static int g_sched_vector = 0;
 static void common_thread_init(x86_64_thread_t *prev) {
     sched_thread_drop(&prev->common);
 
-    x86_64_lapic_timer_oneshot(g_sched_vector, INTERVAL);
+    timer_rearm(arch_sched_thread_current());
 }
 
 static void kernel_thread_init() {
     asm volatile("sti");
 }
 
+/*
+    With MWAIT the idle thread waits on its idle state with interrupts masked (they still break mwait), so it
+    only ever reads POLLING while it is actually running. Other cpus flip it to RESCHED instead of sending an IPI.
+*/
 [[noreturn]] static void sched_idle() {
-    while(true) asm volatile("hlt");
+    x86_64_cpu_t *cpu = X86_64_CPU(arch_sched_thread_current()->cpu);
+    while(true) {
+        if(!g_mwait) {
+            asm volatile("hlt");
+            continue;
+        }
+
+        asm volatile("cli");
+        __atomic_store_n(&cpu->idle_state, X86_64_CPU_IDLE_POLLING, __ATOMIC_SEQ_CST);
+        asm volatile("monitor" : : "a" (&cpu->idle_state), "c" (0), "d" (0) : "memory");
+        if(__atomic_load_n(&cpu->idle_state, __ATOMIC_SEQ_CST) == X86_64_CPU_IDLE_POLLING) {
+            asm volatile("mwait" : : "a" (0), "c" (1) : "memory"); /* C1, ECX.0 = wake on masked interrupts */
+        }
+        bool resched = __atomic_exchange_n(&cpu->idle_state, X86_64_CPU_IDLE_RUNNING, __ATOMIC_ACQ_REL) == X86_64_CPU_IDLE_RESCHED;
+        asm volatile("sti");
+
+        if(resched) arch_sched_yield();
+    }
     ASSERT_COMMENT(false, "Unreachable!");
     __builtin_unreachable();
 }
@@ -105,36 +153,128 @@ static void sched_switch(x86_64_thread_t *this, x86_64_thread_t *next) {
 
     next->common.cpu = this->common.cpu;
     ASSERT(next != NULL);
-    x86_64_msr_write(X86_64_MSR_GS_BASE, (uint64_t) next);
+    if(g_fsgsbase) {
+        asm volatile("wrgsbase %0" : : "r" (next) : "memory");
+    } else {
+        x86_64_msr_write(X86_64_MSR_GS_BASE, (uint64_t) next);
+    }
+    this->common.last_cpu = this->common.cpu;
     this->common.cpu = 0;
 
     x86_64_tss_set_rsp0(X86_64_CPU(next->common.cpu)->tss, next->kernel_stack.base);
 
-    this->state.gs = x86_64_msr_read(X86_64_MSR_KERNEL_GS_BASE);
-	this->state.fs = x86_64_msr_read(X86_64_MSR_FS_BASE);
+    if(g_fsgsbase) {
+        /* The user GS base is only reachable through rdgsbase/wrgsbase while swapped in */
+        asm volatile("rdfsbase %0" : "=r" (this->state.fs));
+        asm volatile("wrfsbase %0" : : "r" (next->state.fs) : "memory");
+        asm volatile("swapgs\nrdgsbase %0\nwrgsbase %1\nswapgs" : "=&r" (this->state.gs) : "r" (next->state.gs) : "memory");
+    } else {
+        this->state.gs = x86_64_msr_read(X86_64_MSR_KERNEL_GS_BASE);
+        this->state.fs = x86_64_msr_read(X86_64_MSR_FS_BASE);
 
-	x86_64_msr_write(X86_64_MSR_KERNEL_GS_BASE, next->state.gs);
-	x86_64_msr_write(X86_64_MSR_FS_BASE, next->state.fs);
+        x86_64_msr_write(X86_64_MSR_KERNEL_GS_BASE, next->state.gs);
+        x86_64_msr_write(X86_64_MSR_FS_BASE, next->state.fs);
+    }
 
-    if(this->state.fpu_area) g_x86_64_fpu_save(this->state.fpu_area);
-    g_x86_64_fpu_restore(next->state.fpu_area);
+    /*
+        FPU state is restored lazily, the first FPU instruction after a switch traps into fpu_trap.
+        Registers are left loaded on switch out so a thread that comes back to a cpu nobody else used the FPU on skips the restore.
+    */
+    x86_64_cpu_t *cpu = X86_64_CPU(next->common.cpu);
+    if(cpu->fpu_enabled && cpu->fpu_owner == this) g_x86_64_fpu_save(this->state.fpu_area);
+    bool fpu_loaded = next->state.fpu_area != NULL && cpu->fpu_owner == next && next->state.fpu_cpu == cpu;
+    if(fpu_loaded != cpu->fpu_enabled) {
+        if(fpu_loaded) {
+            x86_64_fpu_enable();
+        } else {
+            x86_64_fpu_disable();
+        }
+        cpu->fpu_enabled = fpu_loaded;
+    }
 
+    // RFLAGS.AC is per thread, a thread switched out inside a user access gets it back once it resumes here
+    bool user_access = x86_64_uaccess_suspend();
     x86_64_thread_t *prev = x86_64_sched_context_switch(this, next);
     sched_thread_drop(&prev->common);
+    x86_64_uaccess_resume(user_access);
 }
 
-/** @warning Thread should not be on the scheduler queue when this is called */
+/* NULL until the cpu switched to its first thread, placeholders have no cpu */
+static x86_64_cpu_t *current_cpu() {
+    thread_t *current = arch_sched_thread_current();
+    if(current->cpu == NULL) return NULL;
+    return X86_64_CPU(current->cpu);
+}
+
+/*
+    Kernel stacks of destroyed threads are kept in a small per-cpu cache. They are not zeroed, the
+    init stack of a new thread is cleared explicitly and nothing else reads stale stack memory.
+    The page below each stack is left inaccessible so an overflow faults instead of corrupting memory.
+    Stacks allocated before the cpu runs a thread (idle, init) come from the HHDM, changing kernel
+    mappings needs a TLB shootdown which needs a current cpu.
+*/
+static stack_t kernel_stack_alloc() {
+    stack_t stack = { .base = 0, .size = KERNEL_STACK_SIZE_PG * ARCH_PAGE_SIZE, .guarded = true };
+
+    ipl_t old_ipl = ipl(IPL_CRITICAL);
+    x86_64_cpu_t *cpu = current_cpu();
+    if(cpu != NULL && cpu->stack_cache.count > 0) stack.base = cpu->stack_cache.stacks[--cpu->stack_cache.count];
+    ipl(old_ipl);
+
+    if(stack.base == 0 && cpu == NULL) {
+        pmm_page_t *page = pmm_alloc_pages(KERNEL_STACK_SIZE_PG, PMM_STANDARD);
+        stack.base = HHDM(page->paddr + stack.size);
+        stack.guarded = false;
+    }
+
+    if(stack.base == 0) {
+        uintptr_t guard = (uintptr_t) vmm_map_anon(g_vmm_kernel_address_space, NULL, ARCH_PAGE_SIZE + stack.size, VMM_PROT_NONE, VMM_CACHE_STANDARD, VMM_FLAG_NONE);
+        ASSERT(guard != 0);
+        ASSERT(vmm_protect(g_vmm_kernel_address_space, (void *) (guard + ARCH_PAGE_SIZE), stack.size, VMM_PROT_READ | VMM_PROT_WRITE));
+
+        // Populate up front, a fault while the CPU pushes an interrupt frame cannot be demand paged
+        for(uintptr_t page = guard + ARCH_PAGE_SIZE; page < guard + ARCH_PAGE_SIZE + stack.size; page += ARCH_PAGE_SIZE) {
+            ASSERT(vmm_fault(g_vmm_kernel_address_space, page, VMM_FAULT_NONPRESENT | VMM_FAULT_WRITE));
+        }
+        stack.base = guard + ARCH_PAGE_SIZE + stack.size;
+    }
+    return stack;
+}
+
+static void kernel_stack_free(stack_t stack) {
+    if(!stack.guarded) return pmm_free_address(HHDM_TO_PHYS(stack.base - stack.size));
+
+    ipl_t old_ipl = ipl(IPL_CRITICAL);
+    x86_64_cpu_t *cpu = current_cpu();
+    if(cpu != NULL && cpu->stack_cache.count < X86_64_CPU_STACK_CACHE_SIZE) {
+        cpu->stack_cache.stacks[cpu->stack_cache.count++] = stack.base;
+        stack.base = 0;
+    }
+    ipl(old_ipl);
+
+    if(stack.base != 0) vmm_unmap(g_vmm_kernel_address_space, (void *) (stack.base - stack.size - ARCH_PAGE_SIZE), ARCH_PAGE_SIZE + stack.size);
+}
+
+/**
+ * @warning Thread should not be on the scheduler queue when this is called
+ * @warning Must not be called on the stack of the thread being destroyed
+ */
 void arch_sched_thread_destroy(thread_t *thread) {
     if(thread->proc) {
         spinlock_acquire(&thread->proc->lock);
         list_delete(&thread->list_proc);
+        thread->proc->user_time += thread->user_time;
+        thread->proc->system_time += thread->system_time;
         if(list_is_empty(&thread->proc->threads)) {
             sched_process_destroy(thread->proc);
         } else {
             spinlock_release(&thread->proc->lock);
         }
     }
-    heap_free(X86_64_THREAD(thread));
+    x86_64_thread_t *x86_64_thread = X86_64_THREAD(thread);
+    if(x86_64_thread->kernel_stack.base != 0) kernel_stack_free(x86_64_thread->kernel_stack);
+    if(x86_64_thread->state.fpu_area != NULL) heap_free(x86_64_thread->state.fpu_area);
+    heap_free(x86_64_thread);
 }
 
 static x86_64_thread_t *create_thread(process_t *proc, stack_t kernel_stack, uintptr_t rsp) {
@@ -144,51 +284,75 @@ static x86_64_thread_t *create_thread(process_t *proc, stack_t kernel_stack, uin
     thread->common.id = __atomic_fetch_add(&g_next_tid, 1, __ATOMIC_RELAXED);
     thread->common.state = THREAD_STATE_READY;
     thread->common.proc = proc;
+    memset(&thread->common.affinity, 0xFF, sizeof(thread_affinity_t));
     thread->rsp = rsp;
     thread->kernel_stack = kernel_stack;
     thread->state.fs = 0;
     thread->state.gs = 0;
-    thread->state.fpu_area = heap_alloc_align(g_x86_64_fpu_area_size, 64);
-    memset(thread->state.fpu_area, 0, g_x86_64_fpu_area_size);
-
-    g_x86_64_fpu_restore(thread->state.fpu_area);
-    uint16_t x87cw = (1 << 0) | (1 << 1) | (1 << 2) | (1 << 3) | (1 << 4) | (1 << 5) | (0b11 << 8);
-    asm volatile("fldcw %0" : : "m" (x87cw) : "memory");
-    uint32_t mxcsr = (1 << 7) | (1 << 8) | (1 << 9) | (1 << 10) | (1 << 11) | (1 << 12);
-    asm volatile("ldmxcsr %0" : : "m" (mxcsr) : "memory");
-    g_x86_64_fpu_save(thread->state.fpu_area);
-
+    thread->state.fpu_area = NULL;
+    thread->state.fpu_cpu = NULL;
+    if(proc != NULL) {
+        thread->state.fpu_area = heap_alloc_align(g_x86_64_fpu_area_size, 64);
+        x86_64_fpu_area_init(thread->state.fpu_area);
+    }
     return thread;
 }
 
 thread_t *arch_sched_thread_create_kernel(void (* func)()) {
-    pmm_page_t *kernel_stack_page = pmm_alloc_pages(KERNEL_STACK_SIZE_PG, PMM_STANDARD | PMM_FLAG_ZERO);
-    stack_t kernel_stack = {
-        .base = HHDM(kernel_stack_page->paddr + KERNEL_STACK_SIZE_PG * ARCH_PAGE_SIZE),
-        .size = KERNEL_STACK_SIZE_PG * ARCH_PAGE_SIZE
-    };
+    stack_t kernel_stack = kernel_stack_alloc();
 
     init_stack_kernel_t *init_stack = (init_stack_kernel_t *) (kernel_stack.base - sizeof(init_stack_kernel_t));
+    memset(init_stack, 0, sizeof(init_stack_kernel_t));
     init_stack->entry = func;
     init_stack->thread_init = common_thread_init;
     init_stack->thread_init_kernel = kernel_thread_init;
     return &create_thread(NULL, kernel_stack, (uintptr_t) init_stack)->common;
 }
 
-thread_t *arch_sched_thread_create_user(process_t *proc, uintptr_t ip, uintptr_t sp) {
-    pmm_page_t *kernel_stack_page = pmm_alloc_pages(KERNEL_STACK_SIZE_PG, PMM_STANDARD | PMM_FLAG_ZERO);
-    stack_t kernel_stack = {
-        .base = HHDM(kernel_stack_page->paddr + KERNEL_STACK_SIZE_PG * ARCH_PAGE_SIZE),
-        .size = KERNEL_STACK_SIZE_PG * ARCH_PAGE_SIZE
-    };
+thread_t *arch_sched_thread_create_user(process_t *proc, uintptr_t ip, uintptr_t sp, uintptr_t tls) {
+    stack_t kernel_stack = kernel_stack_alloc();
 
     init_stack_user_t *init_stack = (init_stack_user_t *) (kernel_stack.base - sizeof(init_stack_user_t));
+    memset(init_stack, 0, sizeof(init_stack_user_t));
     init_stack->entry = (void (*)()) ip;
     init_stack->thread_init = common_thread_init;
     init_stack->thread_init_user = x86_64_sched_userspace_init;
     init_stack->user_stack = sp;
 
     x86_64_thread_t *thread = create_thread(proc, kernel_stack, (uintptr_t) init_stack);
+    thread->state.fs = tls;
+    spinlock_acquire(&proc->lock);
+    list_append(&proc->threads, &thread->common.list_proc);
+    spinlock_release(&proc->lock);
+    return &thread->common;
+}
+
+thread_t *arch_sched_thread_fork(process_t *proc) {
+    x86_64_thread_t *current = X86_64_THREAD(arch_sched_thread_current());
+
+    stack_t kernel_stack = kernel_stack_alloc();
+
+    init_stack_fork_t *init_stack = (init_stack_fork_t *) (kernel_stack.base - sizeof(init_stack_fork_t));
+    memset(init_stack, 0, sizeof(init_stack_fork_t));
+    init_stack->thread_init = common_thread_init;
+    init_stack->thread_init_fork = x86_64_syscall_fork_return;
+    init_stack->frame = *(x86_64_syscall_frame_t *) (current->kernel_stack.base - sizeof(x86_64_syscall_frame_t));
+
+    // The registers might hold newer state than the save area, the thread must not migrate in between
+    preempt_disable();
+    x86_64_cpu_t *cpu = X86_64_CPU(current->common.cpu);
+    if(cpu->fpu_enabled && cpu->fpu_owner == current) g_x86_64_fpu_save(current->state.fpu_area);
+    preempt_enable();
+    x86_64_thread_t *thread = create_thread(proc, kernel_stack, (uintptr_t) init_stack);
+    memcpy(thread->state.fpu_area, current->state.fpu_area, g_x86_64_fpu_area_size);
+
+    thread->syscall_rsp = current->syscall_rsp;
+    thread->common.policy = current->common.policy;
+    thread->common.nice = current->common.nice;
+    thread->common.affinity = current->common.affinity;
+    thread->state.fs = x86_64_msr_read(X86_64_MSR_FS_BASE);
+    thread->state.gs = x86_64_msr_read(X86_64_MSR_KERNEL_GS_BASE);
+
     spinlock_acquire(&proc->lock);
     list_append(&proc->threads, &thread->common.list_proc);
     spinlock_release(&proc->lock);
@@ -211,11 +375,12 @@ uintptr_t arch_sched_stack_setup(process_t *proc, char **argv, char **envp, auxv
     for(; envp[envc]; envc++) stack -= strlen(envp[envc]) + 1;
     uintptr_t env_data = stack;
 
-    stack -= (stack - (12 + 1 + envc + 1 + argc + 1) * sizeof(uint64_t)) % 0x10;
+    stack -= (stack - (14 + 1 + envc + 1 + argc + 1) * sizeof(uint64_t)) % 0x10;
 
 #define WRITE_AUX(ID, VALUE) { WRITE_QWORD(VALUE); WRITE_QWORD(ID); }
     WRITE_AUX(0, 0);
     WRITE_AUX(AUXV_SECURE, 0);
+    WRITE_AUX(AUXV_HWCAP2, g_fsgsbase ? AUXV_HWCAP2_FSGSBASE : 0);
     WRITE_AUX(AUXV_ENTRY, auxv->entry);
     WRITE_AUX(AUXV_PHDR, auxv->phdr);
     WRITE_AUX(AUXV_PHENT, auxv->phent);
@@ -243,6 +408,19 @@ uintptr_t arch_sched_stack_setup(process_t *proc, char **argv, char **envp, auxv
 #undef WRITE_QWORD
 }
 
+void arch_sched_yield() {
+    uint64_t rflags;
+    asm volatile("pushfq\npop %0\ncli" : "=r" (rflags) : : "memory");
+    x86_64_sched_next();
+    if((rflags & (1 << 9)) != 0) asm volatile("sti");
+}
+
+void arch_sched_preempt(cpu_t *cpu) {
+    x86_64_cpu_idle_state_t polling = X86_64_CPU_IDLE_POLLING;
+    if(g_mwait && __atomic_compare_exchange_n(&X86_64_CPU(cpu)->idle_state, &polling, X86_64_CPU_IDLE_RESCHED, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) return;
+    x86_64_lapic_ipi(X86_64_CPU(cpu)->lapic_id, g_sched_vector | X86_64_LAPIC_IPI_ASSERT);
+}
+
 thread_t *arch_sched_thread_current() {
     x86_64_thread_t *thread = NULL;
     asm volatile("mov %%gs:0, %0" : "=r" (thread));
@@ -253,31 +431,80 @@ void x86_64_sched_next() {
     thread_t *current = arch_sched_thread_current();
     ASSERT(current != NULL);
 
-    thread_t *next = sched_thread_next();
-    if(!next) {
-        if(current == current->cpu->idle_thread) goto oneshot;
-        next = current->cpu->idle_thread;
-    }
-    ASSERT(current != next);
+    // Also covers decisions that keep the current thread, a busy CPU does not have to switch to end a grace period
+    rcu_quiescent();
 
-    sched_switch(X86_64_THREAD(current), X86_64_THREAD(next));
+    thread_t *next = sched_thread_next(current);
+    if(next != NULL) {
+        ASSERT(current != next);
+        sched_switch(X86_64_THREAD(current), X86_64_THREAD(next));
+    }
 
-    oneshot:
-    x86_64_lapic_timer_oneshot(g_sched_vector, INTERVAL);
+    timer_rearm(current);
 }
 
 static void sched_entry([[maybe_unused]] x86_64_interrupt_frame_t *frame) {
+    thread_t *current = arch_sched_thread_current();
+    if(current->preempt_count > 0) {
+        // Switched once preemption is enabled again, the timer retries in case that happens with interrupts masked
+        __atomic_store_n(&current->preempt_pending, true, __ATOMIC_RELAXED);
+        x86_64_lapic_timer_oneshot(g_sched_vector, PREEMPT_RETRY_US);
+        return;
+    }
     x86_64_sched_next();
 }
 
+/*
+    #NM, raised by the first FPU instruction after a switch. The previous owner already saved its state when it was switched out.
+    A stale fpu_owner left by a destroyed thread is harmless, fpu_cpu of a thread reusing its memory starts out NULL.
+*/
+static void fpu_trap([[maybe_unused]] x86_64_interrupt_frame_t *frame) {
+    x86_64_thread_t *current = X86_64_THREAD(arch_sched_thread_current());
+    ASSERT_COMMENT(current->state.fpu_area != NULL, "FPU used by a kernel thread");
+
+    x86_64_cpu_t *cpu = X86_64_CPU(current->common.cpu);
+    x86_64_fpu_enable();
+    cpu->fpu_enabled = true;
+    g_x86_64_fpu_restore(current->state.fpu_area);
+    cpu->fpu_owner = current;
+    current->state.fpu_cpu = cpu;
+}
+
+/* CPUs sharing the last level cache, from the deterministic cache parameters (CPUID 4, or 0x8000001D on AMD) */
+static uint32_t cache_domain(x86_64_cpu_t *cpu) {
+    uint32_t apic_id = cpu->lapic_id;
+    uint32_t topology_ebx, x2apic_id;
+    if(!x86_64_cpuid_register(0xB, 0, X86_64_CPUID_REGISTER_EBX, &topology_ebx) && topology_ebx != 0 && !x86_64_cpuid_register(0xB, 0, X86_64_CPUID_REGISTER_EDX, &x2apic_id)) apic_id = x2apic_id;
+
+    uint32_t sharing = 0, level = 0;
+    uint32_t leaves[] = { 0x4, 0x8000'001D };
+    for(size_t i = 0; i < sizeof(leaves) / sizeof(uint32_t) && sharing == 0; i++) {
+        for(uint32_t subleaf = 0;; subleaf++) {
+            uint32_t eax;
+            if(x86_64_cpuid_register(leaves[i], subleaf, X86_64_CPUID_REGISTER_EAX, &eax) || (eax & 0x1F) == 0) break;
+            if(((eax >> 5) & 0x7) < level) continue;
+            level = (eax >> 5) & 0x7;
+            sharing = ((eax >> 14) & 0xFFF) + 1;
+        }
+    }
+    if(sharing == 0) return 0; // Unknown topology, treat every CPU as sharing one cache
+
+    uint32_t shift = 0;
+    while((1u << shift) < sharing) shift++;
+    return apic_id >> shift;
+}
+
 [[noreturn]] void x86_64_sched_init_cpu(x86_64_cpu_t *cpu, bool release) {
     x86_64_thread_t *idle_thread = X86_64_THREAD(arch_sched_thread_create_kernel(sched_idle));
     idle_thread->common.id = 0;
     cpu->common.idle_thread = &idle_thread->common;
+    cpu->common.cache_domain = cache_domain(cpu);
+    sched_cpu_init(&cpu->common);
+    work_cpu_init(&cpu->common);
 
-    x86_64_thread_t *dummy_thread = heap_alloc(sizeof(x86_64_thread_t));
-    memset(dummy_thread, 0, sizeof(x86_64_thread_t));
-    dummy_thread->this = dummy_thread;
+    // The placeholder is switched away from and destroyed like any exiting thread
+    x86_64_thread_t *dummy_thread = X86_64_THREAD(arch_sched_thread_current());
+    ASSERT(dummy_thread != &g_boot_placeholder);
     dummy_thread->common.state = THREAD_STATE_DESTROY;
     dummy_thread->common.cpu = &cpu->common;
 
@@ -291,8 +518,23 @@ static void sched_entry([[maybe_unused]] x86_64_interrupt_frame_t *frame) {
     __builtin_unreachable();
 }
 
+void x86_64_sched_placeholder_boot() {
+    x86_64_msr_write(X86_64_MSR_GS_BASE, (uint64_t) &g_boot_placeholder);
+}
+
+void x86_64_sched_placeholder_load() {
+    x86_64_thread_t *placeholder = heap_alloc(sizeof(x86_64_thread_t));
+    memset(placeholder, 0, sizeof(x86_64_thread_t));
+    placeholder->this = placeholder;
+    x86_64_msr_write(X86_64_MSR_GS_BASE, (uint64_t) placeholder);
+}
+
 void x86_64_sched_init() {
     int sched_vector = x86_64_interrupt_request(X86_64_INTERRUPT_PRIORITY_SCHED, sched_entry);
     ASSERT_COMMENT(sched_vector >= 0, "Unable to acquire an interrupt vector for the scheduler");
     g_sched_vector = sched_vector;
+    g_fsgsbase = x86_64_cpuid_feature(X86_64_CPUID_FEATURE_FSGSBASE);
+    g_mwait = x86_64_cpuid_feature(X86_64_CPUID_FEATURE_MONITOR) && x86_64_cpuid_feature(X86_64_CPUID_FEATURE_MWAIT_EXTENSIONS) && x86_64_cpuid_feature(X86_64_CPUID_FEATURE_MWAIT_INTERRUPT_BREAK);
+
+    x86_64_interrupt_set(0x7, X86_64_INTERRUPT_PRIORITY_EXCEPTION, fpu_trap);
 }
\ No newline at end of file
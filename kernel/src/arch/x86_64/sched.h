@@ -12,6 +12,19 @@ void x86_64_sched_init();
  */
 [[noreturn]] void x86_64_sched_init_cpu(x86_64_cpu_t *cpu, bool release);
 
+/**
+ * @brief Point GS at a placeholder thread shared by all CPUs during early init
+ * @note Spinlocks track preemption in the current thread, so one has to exist from the very start
+ * @warning Only one CPU may run on the boot placeholder at a time
+ */
+void x86_64_sched_placeholder_boot();
+
+/**
+ * @brief Point GS at a placeholder thread owned by this CPU until it switches to its first thread
+ * @warning Requires the heap
+ */
+void x86_64_sched_placeholder_load();
+
 /**
  * @brief Switch to the next thread
  * @warning This essentially yields to the next thread, without the yield logic
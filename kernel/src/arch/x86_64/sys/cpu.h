@@ -5,6 +5,13 @@
 #include <arch/x86_64/sys/tss.h>
 
 #define X86_64_CPU(CPU) (CONTAINER_OF((CPU), x86_64_cpu_t, common))
+#define X86_64_CPU_STACK_CACHE_SIZE 8
+
+typedef enum {
+    X86_64_CPU_IDLE_RUNNING,
+    X86_64_CPU_IDLE_POLLING, /* idle thread is waiting in mwait on the idle state */
+    X86_64_CPU_IDLE_RESCHED /* set by another cpu instead of sending an IPI */
+} x86_64_cpu_idle_state_t;
 
 typedef struct x86_64_cpu {
     uint32_t lapic_id;
@@ -13,9 +20,19 @@ typedef struct x86_64_cpu {
     x86_64_tss_t *tss;
 
     uintptr_t tlb_shootdown_cr3;
-    spinlock_t tlb_shootdown_check;
+    bool tlb_shootdown_pending; /* set by the initiator, cleared by the target once flushed */
     spinlock_t tlb_shootdown_lock;
 
+    struct x86_64_thread *fpu_owner; /* thread whose state is loaded in the FPU registers */
+    bool fpu_enabled; /* CR0.TS clear, the owner may be modifying the registers */
+
+    x86_64_cpu_idle_state_t idle_state; /* monitored by mwait, writing it wakes the cpu */
+
+    struct {
+        uintptr_t stacks[X86_64_CPU_STACK_CACHE_SIZE]; /* top of cached kernel stacks */
+        size_t count;
+    } stack_cache;
+
     cpu_t common;
 } x86_64_cpu_t;
 
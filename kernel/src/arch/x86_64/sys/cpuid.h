@@ -1,7 +1,8 @@
 #pragma once
 #include <stdint.h>
 
-#define X86_64_CPUID_DEFINE_FEATURE(LEAF, REGISTER, BIT) ((x86_64_cpuid_feature_t) { .leaf = (LEAF), .reg = (REGISTER), .bit = (BIT)})
+#define X86_64_CPUID_DEFINE_FEATURE(LEAF, REGISTER, BIT) ((x86_64_cpuid_feature_t) { .leaf = (LEAF), .subleaf = 0, .reg = (REGISTER), .bit = (BIT)})
+#define X86_64_CPUID_DEFINE_FEATURE_SUBLEAF(LEAF, SUBLEAF, REGISTER, BIT) ((x86_64_cpuid_feature_t) { .leaf = (LEAF), .subleaf = (SUBLEAF), .reg = (REGISTER), .bit = (BIT)})
 #define X86_64_CPUID_FEATURE_SSE3              X86_64_CPUID_DEFINE_FEATURE(1, X86_64_CPUID_REGISTER_ECX, 0)
 #define X86_64_CPUID_FEATURE_PCLMUL            X86_64_CPUID_DEFINE_FEATURE(1, X86_64_CPUID_REGISTER_ECX, 1)
 #define X86_64_CPUID_FEATURE_DTES64            X86_64_CPUID_DEFINE_FEATURE(1, X86_64_CPUID_REGISTER_ECX, 2)
@@ -63,7 +64,15 @@
 #define X86_64_CPUID_FEATURE_TM                X86_64_CPUID_DEFINE_FEATURE(1, X86_64_CPUID_REGISTER_EDX, 29)
 #define X86_64_CPUID_FEATURE_IA64              X86_64_CPUID_DEFINE_FEATURE(1, X86_64_CPUID_REGISTER_EDX, 30)
 #define X86_64_CPUID_FEATURE_PBE               X86_64_CPUID_DEFINE_FEATURE(1, X86_64_CPUID_REGISTER_EDX, 31)
+#define X86_64_CPUID_FEATURE_MWAIT_EXTENSIONS  X86_64_CPUID_DEFINE_FEATURE(5, X86_64_CPUID_REGISTER_ECX, 0)
+#define X86_64_CPUID_FEATURE_MWAIT_INTERRUPT_BREAK X86_64_CPUID_DEFINE_FEATURE(5, X86_64_CPUID_REGISTER_ECX, 1)
+#define X86_64_CPUID_FEATURE_FSGSBASE          X86_64_CPUID_DEFINE_FEATURE(7, X86_64_CPUID_REGISTER_EBX, 0)
 #define X86_64_CPUID_FEATURE_AVX512            X86_64_CPUID_DEFINE_FEATURE(7, X86_64_CPUID_REGISTER_EBX, 16)
+#define X86_64_CPUID_FEATURE_SMAP              X86_64_CPUID_DEFINE_FEATURE(7, X86_64_CPUID_REGISTER_EBX, 20)
+#define X86_64_CPUID_FEATURE_XSAVEOPT          X86_64_CPUID_DEFINE_FEATURE_SUBLEAF(0xD, 1, X86_64_CPUID_REGISTER_EAX, 0)
+#define X86_64_CPUID_FEATURE_XSAVEC            X86_64_CPUID_DEFINE_FEATURE_SUBLEAF(0xD, 1, X86_64_CPUID_REGISTER_EAX, 1)
+#define X86_64_CPUID_FEATURE_XSAVES            X86_64_CPUID_DEFINE_FEATURE_SUBLEAF(0xD, 1, X86_64_CPUID_REGISTER_EAX, 3)
+#define X86_64_CPUID_FEATURE_INVARIANT_TSC     X86_64_CPUID_DEFINE_FEATURE(0x80000007, X86_64_CPUID_REGISTER_EDX, 8)
 
 typedef enum {
     X86_64_CPUID_REGISTER_EAX,
@@ -74,6 +83,7 @@ typedef enum {
 
 typedef struct {
     uint32_t leaf;
+    uint32_t subleaf;
     x86_64_cpuid_register_t reg;
     uint32_t bit;
 } x86_64_cpuid_feature_t;
@@ -89,8 +99,9 @@ bool x86_64_cpuid_feature(x86_64_cpuid_feature_t feature);
 /**
  * @brief Retrieve the value from a specific register exposed by CPUID
  * @param leaf CPUID leaf
+ * @param subleaf CPUID subleaf
  * @param reg register
  * @param out value returned by CPUID
  * @returns false = success
  */
-bool x86_64_cpuid_register(uint32_t leaf, x86_64_cpuid_register_t reg, uint32_t *out);
\ No newline at end of file
+bool x86_64_cpuid_register(uint32_t leaf, uint32_t subleaf, x86_64_cpuid_register_t reg, uint32_t *out);
\ No newline at end of file
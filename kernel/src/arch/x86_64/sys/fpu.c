@@ -1,15 +1,30 @@
 #include "fpu.h"
+#include <lib/mem.h>
 #include <common/assert.h>
+#include <common/log.h>
+#include <memory/heap.h>
 #include <arch/x86_64/sys/cpuid.h>
 
 uint32_t g_x86_64_fpu_area_size = 0;
 void (* g_x86_64_fpu_save)(void *area) = 0;
 void (* g_x86_64_fpu_restore)(void *area) = 0;
 
+static void *g_initial_area;
+
 static inline void xsave(void *area) {
     asm volatile ("xsave (%0)" : : "r" (area), "a" (0xFFFF'FFFF), "d" (0xFFFF'FFFF) : "memory");
 }
 
+/* Skips components that are unmodified since they were last restored from this area */
+static inline void xsaveopt(void *area) {
+    asm volatile ("xsaveopt (%0)" : : "r" (area), "a" (0xFFFF'FFFF), "d" (0xFFFF'FFFF) : "memory");
+}
+
+/* Skips components in their initial state and writes the area in compacted form, xrstor understands both formats */
+static inline void xsavec(void *area) {
+    asm volatile ("xsavec (%0)" : : "r" (area), "a" (0xFFFF'FFFF), "d" (0xFFFF'FFFF) : "memory");
+}
+
 static inline void xrstor(void *area) {
     asm volatile ("xrstor (%0)" : : "r" (area), "a" (0xFFFF'FFFF), "d" (0xFFFF'FFFF) : "memory");
 }
@@ -25,15 +40,39 @@ static inline void fxrstor(void *area) {
 void x86_64_fpu_init() {
     if(x86_64_cpuid_feature(X86_64_CPUID_FEATURE_XSAVE)) {
         uint32_t area_size;
-        ASSERT(!x86_64_cpuid_register(0xD, X86_64_CPUID_REGISTER_ECX, &area_size));
+        if(x86_64_cpuid_feature(X86_64_CPUID_FEATURE_XSAVEC)) {
+            /* Size of the compacted area for the components currently enabled in XCR0 */
+            ASSERT(!x86_64_cpuid_register(0xD, 1, X86_64_CPUID_REGISTER_EBX, &area_size));
+            g_x86_64_fpu_save = xsavec;
+            log(LOG_LEVEL_DEBUG, "FPU", "using xsavec (%u byte area)", area_size);
+        } else {
+            ASSERT(!x86_64_cpuid_register(0xD, 0, X86_64_CPUID_REGISTER_ECX, &area_size));
+            g_x86_64_fpu_save = x86_64_cpuid_feature(X86_64_CPUID_FEATURE_XSAVEOPT) ? xsaveopt : xsave;
+            log(LOG_LEVEL_DEBUG, "FPU", "using %s (%u byte area)", g_x86_64_fpu_save == xsaveopt ? "xsaveopt" : "xsave", area_size);
+        }
         g_x86_64_fpu_area_size = area_size;
-        g_x86_64_fpu_save = xsave;
         g_x86_64_fpu_restore = xrstor;
     } else {
         g_x86_64_fpu_area_size = 512;
         g_x86_64_fpu_save = fxsave;
         g_x86_64_fpu_restore = fxrstor;
     }
+
+    /* Build the initial state once, so creating a thread does not have to go through (and clobber) the live registers */
+    g_initial_area = heap_alloc_align(g_x86_64_fpu_area_size, 64);
+    memset(g_initial_area, 0, g_x86_64_fpu_area_size);
+
+    x86_64_fpu_enable();
+    g_x86_64_fpu_restore(g_initial_area);
+    uint16_t x87cw = (1 << 0) | (1 << 1) | (1 << 2) | (1 << 3) | (1 << 4) | (1 << 5) | (0b11 << 8);
+    asm volatile("fldcw %0" : : "m" (x87cw) : "memory");
+    uint32_t mxcsr = (1 << 7) | (1 << 8) | (1 << 9) | (1 << 10) | (1 << 11) | (1 << 12);
+    asm volatile("ldmxcsr %0" : : "m" (mxcsr) : "memory");
+    g_x86_64_fpu_save(g_initial_area);
+}
+
+void x86_64_fpu_area_init(void *area) {
+    memcpy(area, g_initial_area, g_x86_64_fpu_area_size);
 }
 
 void x86_64_fpu_init_cpu() {
@@ -5,11 +5,35 @@ extern uint32_t g_x86_64_fpu_area_size;
 extern void (* g_x86_64_fpu_save)(void *area);
 extern void (* g_x86_64_fpu_restore)(void *area);
 
+/**
+ * @brief Allow FPU instructions (clear CR0.TS)
+ */
+static inline void x86_64_fpu_enable() {
+    asm volatile("clts" : : : "memory");
+}
+
+/**
+ * @brief Trap the next FPU instruction with #NM (set CR0.TS)
+ */
+static inline void x86_64_fpu_disable() {
+    uint64_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r" (cr0) : : "memory");
+    cr0 |= 1 << 3; /* CR0.TS */
+    asm volatile("mov %0, %%cr0" : : "r" (cr0) : "memory");
+}
+
 /**
  * @brief Initialize FPU
+ * @warning Has to run after x86_64_fpu_init_cpu on the BSP, the save area layout depends on XCR0
  */
 void x86_64_fpu_init();
 
+/**
+ * @brief Fill a save area with the initial FPU state
+ * @param area save area of g_x86_64_fpu_area_size bytes
+ */
+void x86_64_fpu_area_init(void *area);
+
 /**
  * @brief Setup FPU for current CPU
  */
@@ -0,0 +1,24 @@
+#include "tsc.h"
+#include <common/log.h>
+#include <sys/time.h>
+#include <arch/time.h>
+#include <arch/x86_64/sys/cpuid.h>
+
+static bool g_tsc_invariant = false;
+static uint64_t g_tsc_scale; // Nanoseconds per tick as 32.32 fixed point
+
+void x86_64_tsc_init(uint64_t frequency) {
+    // A TSC that changes rate with P-states or stops in deep C-states does not measure time
+    if(frequency == 0 || !x86_64_cpuid_feature(X86_64_CPUID_FEATURE_INVARIANT_TSC)) {
+        log(LOG_LEVEL_WARN, "TSC", "No invariant TSC, time counter falls back to the monotonic clock");
+        return;
+    }
+    g_tsc_scale = ((uint64_t) TIME_NANOSECONDS_IN_SECOND << 32) / frequency;
+    g_tsc_invariant = true;
+    log(LOG_LEVEL_DEBUG, "TSC", "Invariant TSC at %lu Hz", frequency);
+}
+
+uint64_t arch_time_counter() {
+    if(!g_tsc_invariant) return time_nanoseconds(g_time_monotonic);
+    return (uint64_t) (((unsigned __int128) x86_64_tsc_read() * g_tsc_scale) >> 32);
+}
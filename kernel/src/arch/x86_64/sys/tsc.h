@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * @brief Read the time stamp counter
+ */
+static inline uint64_t x86_64_tsc_read() {
+    uint32_t low;
+    uint32_t high;
+    asm volatile("rdtsc" : "=a" (low), "=d" (high));
+    return low + ((uint64_t) high << 32);
+}
+
+/**
+ * @brief Initializes the TSC as the time counter
+ * @param frequency calibrated TSC frequency in hertz
+ */
+void x86_64_tsc_init(uint64_t frequency);
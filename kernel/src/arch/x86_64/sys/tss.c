@@ -3,4 +3,10 @@
 void x86_64_tss_set_rsp0(x86_64_tss_t *tss, uintptr_t stack_pointer) {
     tss->rsp0_lower = (uint32_t) (uint64_t) stack_pointer;
     tss->rsp0_upper = (uint32_t) ((uint64_t) stack_pointer >> 32);
+}
+
+void x86_64_tss_set_ist(x86_64_tss_t *tss, int ist, uintptr_t stack_pointer) {
+    uint32_t *entry = &tss->ist1_lower + (ist - 1) * 2;
+    entry[0] = (uint32_t) (uint64_t) stack_pointer;
+    entry[1] = (uint32_t) ((uint64_t) stack_pointer >> 32);
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #pragma once
 #include <stdint.h>
 
+#define X86_64_TSS_IST_IRQ 1
+#define X86_64_TSS_IST_DOUBLE_FAULT 2
+#define X86_64_TSS_IST_NMI 3
+
 typedef struct {
 	uint32_t rsv0;
 	uint32_t rsp0_lower;
@@ -36,4 +40,12 @@ typedef struct {
  * @param tss Task state segment
  * @param stack_pointer CPL0 stack pointer
  */
-void x86_64_tss_set_rsp0(x86_64_tss_t *tss, uintptr_t stack_pointer);
\ No newline at end of file
+void x86_64_tss_set_rsp0(x86_64_tss_t *tss, uintptr_t stack_pointer);
+
+/**
+ * @brief Sets an interrupt stack table entry
+ * @param tss Task state segment
+ * @param ist IST index (1-7)
+ * @param stack_pointer stack pointer loaded when an interrupt using this entry is raised
+ */
+void x86_64_tss_set_ist(x86_64_tss_t *tss, int ist, uintptr_t stack_pointer);
\ No newline at end of file
@@ -2,6 +2,8 @@ SYSCALL_RSP_OFFSET equ 16
 KERNEL_STACK_BASE_OFFSET equ 24
 
 extern x86_64_syscall_exit
+extern x86_64_syscall_account_enter
+extern x86_64_syscall_account_exit
 extern syscall_debug
 extern syscall_mem_anon_allocate
 extern syscall_mem_anon_free
@@ -17,6 +19,19 @@ extern syscall_elib_framebuffer
 extern syscall_time_clock
 extern syscall_elib_input
 extern syscall_fs_getcwd
+extern syscall_proc_fork
+extern syscall_mem_map
+extern syscall_mem_unmap
+extern syscall_mem_protect
+extern syscall_proc_set_priority
+extern syscall_futex_wait
+extern syscall_futex_wake
+extern syscall_futex_requeue
+extern syscall_proc_thread_create
+extern syscall_proc_thread_exit
+extern syscall_proc_set_affinity
+extern syscall_proc_get_affinity
+extern syscall_proc_rusage
 
 section .data
 syscall_table:
@@ -36,6 +51,19 @@ syscall_table:
     dq syscall_time_clock ; 13
     dq syscall_elib_input ; 14
     dq syscall_fs_getcwd ; 15
+    dq syscall_proc_fork ; 16
+    dq syscall_mem_map ; 17
+    dq syscall_mem_unmap ; 18
+    dq syscall_mem_protect ; 19
+    dq syscall_proc_set_priority ; 20
+    dq syscall_futex_wait ; 21
+    dq syscall_futex_wake ; 22
+    dq syscall_futex_requeue ; 23
+    dq syscall_proc_thread_create ; 24
+    dq syscall_proc_thread_exit ; 25
+    dq syscall_proc_set_affinity ; 26
+    dq syscall_proc_get_affinity ; 27
+    dq syscall_proc_rusage ; 28
 .length: dq ($ - syscall_table) / 8
 
 section .text
@@ -64,6 +92,19 @@ x86_64_syscall_entry:
     mov r14, ds
     push r14
 
+    ; Charge CPU time up to here as user time, the call clobbers the argument registers so reload them from the frame
+    mov r12, rax
+    call x86_64_syscall_account_enter
+    mov rax, r12
+    mov rdi, qword [rsp + 80]
+    mov rsi, qword [rsp + 88]
+    mov rdx, qword [rsp + 104]
+    mov r10, qword [rsp + 56]
+    mov r8, qword [rsp + 72]
+    mov r9, qword [rsp + 64]
+
+    sti                                                     ; Syscalls run with interrupts enabled, preemptible wherever no spinlock is held
+
     cmp rax, qword [syscall_table.length]
     jge .invalid_syscall
 
@@ -79,7 +120,19 @@ x86_64_syscall_entry:
     mov rbx, rdx ; Cannot use rdx for return value
 
     .invalid_syscall:
+    cli                                                     ; Clear interrupts as we are returning to userspace
+    mov r12, rax
+    call x86_64_syscall_account_exit
+    mov rax, r12
+    jmp syscall_exit
+
+global x86_64_syscall_fork_return
+x86_64_syscall_fork_return:
+    cli                                                     ; Clear interrupts as we are returning to userspace
+    xor rax, rax                                            ; The new thread returns 0 from fork
+    xor rbx, rbx
 
+syscall_exit:
     pop rdi
     mov ds, rdi
     pop rdi
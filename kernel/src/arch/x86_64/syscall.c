@@ -1,10 +1,12 @@
 #include <stdint.h>
+#include <stddef.h>
 #include <errno.h>
 #include <common/log.h>
+#include <sched/sched.h>
 #include <sched/thread.h>
 #include <syscall/syscall.h>
 #include <arch/sched.h>
-#include <arch/x86_64/sched.h>
+#include <arch/x86_64/syscall.h>
 #include <arch/x86_64/sys/msr.h>
 #include <arch/x86_64/sys/gdt.h>
 
@@ -14,8 +16,10 @@ extern void x86_64_syscall_entry();
 
 void x86_64_syscall_exit(int code) {
     log(LOG_LEVEL_DEBUG, "SYSCALL", "exit(code: %i, tid: %li)", code, arch_sched_thread_current()->id);
+    sched_process_exit(arch_sched_thread_current()->proc);
+    // Still in the syscall, so the exiting process alone would not get it destroyed
     arch_sched_thread_current()->state = THREAD_STATE_DESTROY;
-    x86_64_sched_next();
+    arch_sched_yield();
     __builtin_unreachable();
 }
 
@@ -26,6 +30,17 @@ syscall_return_t x86_64_syscall_fs_set(void *ptr) {
     return ret;
 }
 
+void x86_64_syscall_account_enter() {
+    sched_thread_syscall_enter(arch_sched_thread_current());
+}
+
+void x86_64_syscall_account_exit() {
+    sched_thread_syscall_exit(arch_sched_thread_current());
+}
+
+static_assert(offsetof(x86_64_syscall_frame_t, rdi) == 80 && offsetof(x86_64_syscall_frame_t, rsi) == 88 && offsetof(x86_64_syscall_frame_t, rdx) == 104, "syscall frame changed. Update arch/x86_64/syscall.asm argument reloads");
+static_assert(offsetof(x86_64_syscall_frame_t, r10) == 56 && offsetof(x86_64_syscall_frame_t, r9) == 64 && offsetof(x86_64_syscall_frame_t, r8) == 72, "syscall frame changed. Update arch/x86_64/syscall.asm argument reloads");
+
 // Ensure GDT conforms to sysret
 static_assert(X86_64_GDT_SELECTOR_DATA64_RING3 + 8 == X86_64_GDT_SELECTOR_CODE64_RING3);
 
@@ -33,5 +48,5 @@ void x86_64_syscall_init_cpu() {
     x86_64_msr_write(X86_64_MSR_EFER, x86_64_msr_read(X86_64_MSR_EFER) | MSR_EFER_SCE);
     x86_64_msr_write(X86_64_MSR_STAR, ((uint64_t) X86_64_GDT_SELECTOR_CODE64_RING0 << 32) | ((uint64_t) (X86_64_GDT_SELECTOR_DATA64_RING3 - 8) << 48));
     x86_64_msr_write(X86_64_MSR_LSTAR, (uint64_t) x86_64_syscall_entry);
-    x86_64_msr_write(X86_64_MSR_SFMASK, x86_64_msr_read(X86_64_MSR_SFMASK) | (1 << 9));
+    x86_64_msr_write(X86_64_MSR_SFMASK, x86_64_msr_read(X86_64_MSR_SFMASK) | (1 << 9) | (1 << 18)); // Mask IF and AC, AC would let userspace disable SMAP. IF is set again once on the kernel stack
 }
\ No newline at end of file
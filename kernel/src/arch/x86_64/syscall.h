@@ -1,4 +1,11 @@
 #pragma once
+#include <stdint.h>
+
+typedef struct {
+    uint64_t ds, es;
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rdi, rsi, rbp, rdx, rcx;
+} __attribute__((packed)) x86_64_syscall_frame_t;
 
 /**
  * @brief Initializes syscalls for CPU
@@ -1,21 +1,34 @@
+#include <errno.h>
 #include <syscall/syscall.h>
 #include <common/log.h>
 #include <common/spinlock.h>
+#include <sched/sched.h>
+#include <sched/waitqueue.h>
 #include <arch/x86_64/dev/ps2kb.h>
-#include <arch/cpu.h>
+
+#define INPUT_BUFFER_SIZE 64
 
 static bool g_acquired_input = false;
 
 static spinlock_t g_lock = SPINLOCK_INIT;
+static waitqueue_t g_input_waitqueue = WAITQUEUE_INIT(g_input_waitqueue);
+
+static uint8_t g_input_buffer[INPUT_BUFFER_SIZE];
+static size_t g_input_head = 0;
+static size_t g_input_count = 0;
 
-static bool got_input = false;
-static char input_buffer = '\0';
+static bool input_available([[maybe_unused]] void *data) {
+    return __atomic_load_n(&g_input_count, __ATOMIC_ACQUIRE) != 0 || sched_thread_interrupted();
+}
 
 static void elib_input(uint8_t ch) {
-    spinlock_acquire(&g_lock);
-    input_buffer = ch;
-    got_input = true;
-    spinlock_release(&g_lock);
+    ipl_t old_ipl = spinlock_acquire_irqsave(&g_lock);
+    if(g_input_count < INPUT_BUFFER_SIZE) {
+        g_input_buffer[(g_input_head + g_input_count) % INPUT_BUFFER_SIZE] = ch;
+        __atomic_store_n(&g_input_count, g_input_count + 1, __ATOMIC_RELEASE);
+    }
+    spinlock_release_irqrestore(&g_lock, old_ipl);
+    waitqueue_wake_one(&g_input_waitqueue);
 }
 
 syscall_return_t syscall_elib_input() {
@@ -27,13 +40,21 @@ syscall_return_t syscall_elib_input() {
         g_acquired_input = true;
     }
 
-    spinlock_acquire(&g_lock);
-
-    int input = -1;
-    if(got_input) input = input_buffer;
-    got_input = false;
-
-    spinlock_release(&g_lock);
+    // The lock is shared with the keyboard interrupt, so it cannot be handed to waitqueue_wait
+    ipl_t old_ipl = spinlock_acquire_irqsave(&g_lock);
+    while(g_input_count == 0) {
+        spinlock_release_irqrestore(&g_lock, old_ipl);
+        if(sched_thread_interrupted()) {
+            ret.err = EINTR;
+            return ret;
+        }
+        waitqueue_wait_unless(&g_input_waitqueue, input_available, NULL);
+        old_ipl = spinlock_acquire_irqsave(&g_lock);
+    }
+    int input = g_input_buffer[g_input_head];
+    g_input_head = (g_input_head + 1) % INPUT_BUFFER_SIZE;
+    g_input_count--;
+    spinlock_release_irqrestore(&g_lock, old_ipl);
 
     ret.value = input;
     ret.err = 0;
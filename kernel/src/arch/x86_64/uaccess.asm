@@ -0,0 +1,17 @@
+global x86_64_uaccess_copy
+global g_x86_64_uaccess_fixups
+global g_x86_64_uaccess_fixup_count
+
+section .text
+x86_64_uaccess_copy:
+    mov rcx, rdx
+.copy:
+    rep movsb                                               ; On a fault rcx holds the remaining count and execution resumes at .done
+.done:
+    mov rax, rcx
+    ret
+
+section .data
+g_x86_64_uaccess_fixups:
+    dq x86_64_uaccess_copy.copy, x86_64_uaccess_copy.done
+g_x86_64_uaccess_fixup_count: dq ($ - g_x86_64_uaccess_fixups) / 16
\ No newline at end of file
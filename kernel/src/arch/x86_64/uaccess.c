@@ -0,0 +1,74 @@
+#include "uaccess.h"
+#include <stdint.h>
+#include <arch/uaccess.h>
+#include <arch/x86_64/sys/cpuid.h>
+
+#define RFLAGS_AC (1 << 18)
+
+typedef struct {
+    uintptr_t ip;
+    uintptr_t fixup_ip;
+} __attribute__((packed)) fixup_t;
+
+extern fixup_t g_x86_64_uaccess_fixups[];
+extern uint64_t g_x86_64_uaccess_fixup_count;
+
+/**
+ * @returns bytes not copied
+ */
+extern size_t x86_64_uaccess_copy(void *dest, void *src, size_t count);
+
+bool g_x86_64_uaccess_smap = false; // Read by the interrupt entry in arch/x86_64/interrupt.asm
+
+void x86_64_uaccess_init_cpu() {
+    uint64_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r" (cr0) : : "memory");
+    cr0 |= 1 << 16; /* CR0.WP */
+    asm volatile("mov %0, %%cr0" : : "r" (cr0) : "memory");
+
+    if(!x86_64_cpuid_feature(X86_64_CPUID_FEATURE_SMAP)) return;
+    uint64_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r" (cr4) : : "memory");
+    cr4 |= 1 << 21; /* CR4.SMAP */
+    asm volatile("mov %0, %%cr4" : : "r" (cr4) : "memory");
+    g_x86_64_uaccess_smap = true;
+}
+
+bool x86_64_uaccess_permitted(x86_64_interrupt_frame_t *frame) {
+    return !g_x86_64_uaccess_smap || (frame->rflags & RFLAGS_AC) != 0;
+}
+
+bool x86_64_uaccess_fixup(x86_64_interrupt_frame_t *frame) {
+    for(uint64_t i = 0; i < g_x86_64_uaccess_fixup_count; i++) {
+        if(g_x86_64_uaccess_fixups[i].ip != frame->rip) continue;
+        frame->rip = g_x86_64_uaccess_fixups[i].fixup_ip;
+        return true;
+    }
+    return false;
+}
+
+bool x86_64_uaccess_suspend() {
+    if(!g_x86_64_uaccess_smap) return false;
+    uint64_t rflags;
+    asm volatile("pushfq\npop %0\nclac" : "=r" (rflags) : : "memory");
+    return (rflags & RFLAGS_AC) != 0;
+}
+
+void x86_64_uaccess_resume(bool user_access) {
+    if(user_access) asm volatile("stac" : : : "memory");
+}
+
+static size_t copy(void *dest, void *src, size_t count) {
+    if(g_x86_64_uaccess_smap) asm volatile("stac" : : : "memory");
+    size_t remaining = x86_64_uaccess_copy(dest, src, count);
+    if(g_x86_64_uaccess_smap) asm volatile("clac" : : : "memory");
+    return count - remaining;
+}
+
+size_t arch_uaccess_copy_to(void *dest, void *src, size_t count) {
+    return copy(dest, src, count);
+}
+
+size_t arch_uaccess_copy_from(void *dest, void *src, size_t count) {
+    return copy(dest, src, count);
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+#pragma once
+#include <arch/x86_64/interrupt.h>
+
+/**
+ * @brief Enables user access protections (write protect, SMAP when available) for the current CPU
+ */
+void x86_64_uaccess_init_cpu();
+
+/**
+ * @brief Test whether a supervisor page fault on a userspace address was raised by an intentional user access
+ * @returns false if SMAP is enabled and the access happened outside of a user access routine
+ */
+bool x86_64_uaccess_permitted(x86_64_interrupt_frame_t *frame);
+
+/**
+ * @brief Redirect a fault inside a user access routine to its fixup
+ * @returns true if the faulting instruction has a fixup
+ */
+bool x86_64_uaccess_fixup(x86_64_interrupt_frame_t *frame);
+
+/**
+ * @brief Close user access before switching threads, the next thread must not inherit RFLAGS.AC
+ * @returns whether user access was open, to be handed to x86_64_uaccess_resume
+ */
+bool x86_64_uaccess_suspend();
+
+/**
+ * @brief Reopen user access closed by x86_64_uaccess_suspend once the thread runs again
+ */
+void x86_64_uaccess_resume(bool user_access);
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include <memory/pmm.h>
 #include <memory/hhdm.h>
 #include <memory/heap.h>
+#include <sched/sched.h>
+#include <sched/thread.h>
 #include <sys/ipl.h>
 #include <sys/cpu.h>
 #include <arch/vmm.h>
@@ -15,6 +17,7 @@
 #include <arch/x86_64/init.h>
 #include <arch/x86_64/interrupt.h>
 #include <arch/x86_64/exception.h>
+#include <arch/x86_64/uaccess.h>
 #include <arch/x86_64/sys/lapic.h>
 #include <arch/x86_64/sys/cpu.h>
 
@@ -48,6 +51,7 @@ typedef enum {
     PTE_FLAG_ACCESSED = (1 << 5),
     PTE_FLAG_PAT = (1 << 7),
     PTE_FLAG_GLOBAL = (1 << 8),
+    PTE_FLAG_PROT_NONE = (1 << 9), // Software bit, marks a non-present entry that still holds a page
     PTE_FLAG_NX = ((uint64_t) 1 << 63)
 } pte_flag_t;
 
@@ -81,6 +85,15 @@ static inline uintptr_t pte_get_address(uint64_t entry) {
     return entry & ADDRESS_MASK;
 }
 
+static inline bool pte_holds_page(uint64_t entry) {
+    return (entry & (PTE_FLAG_PRESENT | PTE_FLAG_PROT_NONE)) != 0;
+}
+
+static inline uint64_t pte_from_x86_flags(uint64_t x86_flags) {
+    if(x86_flags & PTE_FLAG_PROT_NONE) return x86_flags;
+    return PTE_FLAG_PRESENT | x86_flags;
+}
+
 static inline void write_cr3(uint64_t value) {
     asm volatile("movq %0, %%cr3" : : "r" (value) : "memory");
 }
@@ -93,6 +106,7 @@ static inline uint64_t read_cr3() {
 
 static uint64_t flags_cache_prot_to_x86_flags(vmm_protection_t prot, vmm_cache_t cache, int flags) {
     uint64_t x86_flags = 0;
+    if(prot == VMM_PROT_NONE) return PTE_FLAG_PROT_NONE;
     if((prot & VMM_PROT_READ) == 0) panic("!VMM_PROT_READ not supported");
     if((prot & VMM_PROT_WRITE) != 0) x86_flags |= PTE_FLAG_RW;
     if((prot & VMM_PROT_EXEC) == 0) x86_flags |= PTE_FLAG_NX;
@@ -118,11 +132,11 @@ static void tlb_shootdown(vmm_address_space_t *address_space) {
             continue;
         }
 
+        // A flag rather than a lock, the target CPU is the one clearing it
         spinlock_acquire(&cpu->tlb_shootdown_lock);
-        spinlock_acquire(&cpu->tlb_shootdown_check);
         cpu->tlb_shootdown_cr3 = X86_64_AS(address_space)->cr3;
+        __atomic_store_n(&cpu->tlb_shootdown_pending, true, __ATOMIC_RELEASE);
 
-        asm volatile("" : : : "memory");
         x86_64_lapic_ipi(cpu->lapic_id, g_tlb_shootdown_vector | X86_64_LAPIC_IPI_ASSERT);
 
         volatile int timeout = 0;
@@ -133,9 +147,9 @@ static void tlb_shootdown(vmm_address_space_t *address_space) {
             }
             if(timeout >= 3000) break;
             x86_64_lapic_ipi(cpu->lapic_id, g_tlb_shootdown_vector | X86_64_LAPIC_IPI_ASSERT);
-        } while(!spinlock_try_acquire(&cpu->tlb_shootdown_check));
+        } while(__atomic_load_n(&cpu->tlb_shootdown_pending, __ATOMIC_ACQUIRE));
 
-        spinlock_release(&cpu->tlb_shootdown_check);
+        __atomic_store_n(&cpu->tlb_shootdown_pending, false, __ATOMIC_RELAXED);
         spinlock_release(&cpu->tlb_shootdown_lock);
     }
     ipl(old_ipl);
@@ -143,9 +157,9 @@ static void tlb_shootdown(vmm_address_space_t *address_space) {
 
 static void tlb_shootdown_handler([[maybe_unused]] x86_64_interrupt_frame_t *frame) {
     x86_64_cpu_t *cpu = X86_64_CPU(cpu_current());
-    if(spinlock_try_acquire(&cpu->tlb_shootdown_check)) return spinlock_release(&cpu->tlb_shootdown_check);
+    if(!__atomic_load_n(&cpu->tlb_shootdown_pending, __ATOMIC_ACQUIRE)) return;
     if(cpu->tlb_shootdown_cr3 == g_initial_address_space.cr3 || read_cr3() == cpu->tlb_shootdown_cr3) write_cr3(read_cr3());
-    spinlock_release(&cpu->tlb_shootdown_check);
+    __atomic_store_n(&cpu->tlb_shootdown_pending, false, __ATOMIC_RELEASE);
 }
 
 vmm_address_space_t *arch_vmm_address_space_create() {
@@ -154,15 +168,38 @@ vmm_address_space_t *arch_vmm_address_space_create() {
     memcpy((void *) HHDM(address_space->cr3 + 256 * sizeof(uint64_t)), (void *) HHDM(X86_64_AS(g_vmm_kernel_address_space)->cr3 + 256 * sizeof(uint64_t)), 256 * sizeof(uint64_t));
 
     address_space->cr3_lock = SPINLOCK_INIT;
-    address_space->common.lock = SPINLOCK_INIT;
+    address_space->common.lock = RWLOCK_INIT;
+    lockstat_register(&address_space->common.lock.writer, "address_space");
     address_space->common.segments = LIST_INIT;
     address_space->common.start = USERSPACE_START;
     address_space->common.end = USERSPACE_END;
     return &address_space->common;
 }
 
+static void table_free(uintptr_t table, int level) {
+    uint64_t *entries = (uint64_t *) HHDM(table);
+    if(level > 1) {
+        for(int i = 0; i < 512; i++) {
+            if(entries[i] & PTE_FLAG_PRESENT) table_free(pte_get_address(entries[i]), level - 1);
+        }
+    }
+    pmm_free_address(table);
+}
+
+void arch_vmm_address_space_destroy(vmm_address_space_t *address_space) {
+    ASSERT(X86_64_AS(address_space) != &g_initial_address_space && read_cr3() != X86_64_AS(address_space)->cr3);
+    // The upper half is shared with the kernel address space and stays
+    uint64_t *pml4 = (uint64_t *) HHDM(X86_64_AS(address_space)->cr3);
+    for(int i = 0; i < 256; i++) {
+        if(pml4[i] & PTE_FLAG_PRESENT) table_free(pte_get_address(pml4[i]), 3);
+    }
+    pmm_free_address(X86_64_AS(address_space)->cr3);
+    heap_free(X86_64_AS(address_space));
+}
+
 vmm_address_space_t *x86_64_vmm_init() {
-    g_initial_address_space.common.lock = SPINLOCK_INIT;
+    g_initial_address_space.common.lock = RWLOCK_INIT;
+    lockstat_register(&g_initial_address_space.common.lock.writer, "kernel_address_space");
     g_initial_address_space.common.segments = LIST_INIT;
     g_initial_address_space.common.start = KERNELSPACE_START;
     g_initial_address_space.common.end = KERNELSPACE_END;
@@ -210,8 +247,44 @@ void arch_vmm_ptm_map(vmm_address_space_t *address_space, uintptr_t vaddr, uintp
         current_table = (uint64_t *) HHDM(pte_get_address(current_table[index]));
     }
     int index = VADDR_TO_INDEX(vaddr, 1);
-    current_table[index] = PTE_FLAG_PRESENT | x86_flags;
+    bool was_present = (current_table[index] & PTE_FLAG_PRESENT) != 0;
+    current_table[index] = pte_from_x86_flags(x86_flags);
     pte_set_address(&current_table[index], paddr);
+    if(was_present) tlb_shootdown(address_space); // Non-present entries are never cached
+    spinlock_release(&X86_64_AS(address_space)->cr3_lock);
+}
+
+void arch_vmm_ptm_protect(vmm_address_space_t *address_space, uintptr_t vaddr, size_t length, vmm_protection_t prot, vmm_cache_t cache, int flags) {
+    uint64_t x86_flags = flags_cache_prot_to_x86_flags(prot, cache, flags);
+    spinlock_acquire(&X86_64_AS(address_space)->cr3_lock);
+    for(uintptr_t address = vaddr; address < vaddr + length;) {
+        uint64_t *current_table = (uint64_t *) HHDM(X86_64_AS(address_space)->cr3);
+        int level = 4;
+        for(; level > 1; level--) {
+            int index = VADDR_TO_INDEX(address, level);
+            if(!(current_table[index] & PTE_FLAG_PRESENT)) break;
+            if((x86_flags & PTE_FLAG_NX) == 0) current_table[index] &= ~PTE_FLAG_NX;
+            current_table[index] |= (x86_flags & (PTE_FLAG_RW | PTE_FLAG_USER));
+            current_table = (uint64_t *) HHDM(pte_get_address(current_table[index]));
+        }
+        uintptr_t level_size = (uintptr_t) ARCH_PAGE_SIZE << ((level - 1) * 9);
+        if(level == 1) {
+            int index = VADDR_TO_INDEX(address, 1);
+            if(pte_holds_page(current_table[index])) {
+                uintptr_t paddr = pte_get_address(current_table[index]);
+                current_table[index] = pte_from_x86_flags(x86_flags);
+                pte_set_address(&current_table[index], paddr);
+            }
+        }
+        uintptr_t next = (address & ~(level_size - 1)) + level_size; // Skip the whole range of a missing table
+        if(next < address) break;
+        address = next;
+    }
+    spinlock_release(&X86_64_AS(address_space)->cr3_lock);
+}
+
+void arch_vmm_tlb_shootdown(vmm_address_space_t *address_space) {
+    spinlock_acquire(&X86_64_AS(address_space)->cr3_lock);
     tlb_shootdown(address_space);
     spinlock_release(&X86_64_AS(address_space)->cr3_lock);
 }
@@ -221,18 +294,16 @@ void arch_vmm_ptm_unmap(vmm_address_space_t *address_space, uintptr_t vaddr) {
     uint64_t *current_table = (uint64_t *) HHDM(X86_64_AS(address_space)->cr3);
     for(int i = 4; i > 1; i--) {
         int index = VADDR_TO_INDEX(vaddr, i);
-        if(!(current_table[index] & PTE_FLAG_PRESENT)) {
-            spinlock_release(&X86_64_AS(address_space)->cr3_lock);
-            goto cleanup;
-        }
+        if(!(current_table[index] & PTE_FLAG_PRESENT)) goto cleanup;
         current_table = (uint64_t *) HHDM(pte_get_address(current_table[index]));
     }
     int index = VADDR_TO_INDEX(vaddr, 1);
-    if(!(current_table[index] & PTE_FLAG_PRESENT)) goto cleanup;
+    if(!pte_holds_page(current_table[index])) goto cleanup;
+    bool was_present = (current_table[index] & PTE_FLAG_PRESENT) != 0;
     current_table[index] = 0;
+    if(was_present) tlb_shootdown(address_space);
 
     cleanup:
-    tlb_shootdown(address_space);
     spinlock_release(&X86_64_AS(address_space)->cr3_lock);
 }
 
@@ -249,7 +320,7 @@ bool arch_vmm_ptm_physical(vmm_address_space_t *address_space, uintptr_t vaddr,
     }
     uint64_t entry = current_table[VADDR_TO_INDEX(vaddr, 1)];
     spinlock_release(&X86_64_AS(address_space)->cr3_lock);
-    if(!(entry & PTE_FLAG_PRESENT)) return false;
+    if(!pte_holds_page(entry)) return false;
     *out = pte_get_address(entry);
     return true;
 }
@@ -257,6 +328,7 @@ bool arch_vmm_ptm_physical(vmm_address_space_t *address_space, uintptr_t vaddr,
 void x86_64_vmm_page_fault_handler(x86_64_interrupt_frame_t *frame) {
     int flags = 0;
     if(!(frame->err_code & PAGEFAULT_FLAG_PRESENT)) flags |= VMM_FAULT_NONPRESENT;
+    if(frame->err_code & PAGEFAULT_FLAG_WRITE) flags |= VMM_FAULT_WRITE;
 
     vmm_address_space_t *as = g_vmm_kernel_address_space;
     if(x86_64_init_stage() >= X86_64_INIT_STAGE_SCHED) {
@@ -266,6 +338,21 @@ void x86_64_vmm_page_fault_handler(x86_64_interrupt_frame_t *frame) {
 
     uint64_t cr2;
     asm volatile("movq %%cr2, %0" : "=r" (cr2));
-    if(vmm_fault(as, cr2, flags)) return;
+    bool user = (frame->err_code & PAGEFAULT_FLAG_USER) != 0;
+    if(!user && cr2 <= USERSPACE_END && !x86_64_uaccess_permitted(frame)) x86_64_exception_unhandled(frame);
+
+    /*
+        Faults on file mappings call into the file system, which may block. The handler runs with the interrupt state of the faulting code,
+        a fault from user space is kernel work on behalf of the thread and is accounted and reaped like a syscall.
+    */
+    thread_t *current = user ? arch_sched_thread_current() : NULL;
+    if(user) sched_thread_syscall_enter(current);
+    if((frame->rflags & (1 << 9)) != 0) asm volatile("sti");
+    bool handled = vmm_fault(as, cr2, flags);
+    asm volatile("cli");
+    if(user) sched_thread_syscall_exit(current);
+
+    if(handled) return;
+    if(!user && x86_64_uaccess_fixup(frame)) return;
     x86_64_exception_unhandled(frame);
 }
\ No newline at end of file
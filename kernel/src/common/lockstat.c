@@ -0,0 +1,90 @@
+#include "lockstat.h"
+#include <lib/str.h>
+#include <common/spinlock.h>
+#include <arch/time.h>
+
+#if LOCKSTAT
+static lockstat_t g_stats[LOCKSTAT_MAX_LOCKS];
+static size_t g_stat_count = 0;
+static spinlock_t g_lock = SPINLOCK_INIT; // Only guards registration, it is never profiled itself
+
+static void max_update(uint64_t *max, void **max_site, uint64_t value, void *site) {
+    uint64_t current = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while(value > current) {
+        if(!__atomic_compare_exchange_n(max, &current, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) continue;
+        __atomic_store_n(max_site, site, __ATOMIC_RELAXED);
+        return;
+    }
+}
+
+static lockstat_site_t *site_get(lockstat_t *stat, void *site) {
+    for(size_t i = 0; i < LOCKSTAT_SITES; i++) {
+        void *expected = __atomic_load_n(&stat->sites[i].site, __ATOMIC_RELAXED);
+        if(expected == site) return &stat->sites[i];
+        if(expected != NULL) continue;
+        if(__atomic_compare_exchange_n(&stat->sites[i].site, &expected, site, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED) || expected == site) return &stat->sites[i];
+    }
+    return NULL;
+}
+
+void lockstat_register(volatile spinlock_t *lock, const char *name) {
+    spinlock_acquire(&g_lock);
+    lockstat_t *stat = NULL;
+    for(size_t i = 0; i < g_stat_count; i++) {
+        if(strcmp(g_stats[i].name, name) != 0) continue;
+        stat = &g_stats[i];
+        break;
+    }
+    if(stat == NULL && g_stat_count < LOCKSTAT_MAX_LOCKS) {
+        stat = &g_stats[g_stat_count];
+        stat->name = name;
+        __atomic_store_n(&g_stat_count, g_stat_count + 1, __ATOMIC_RELEASE);
+    }
+    spinlock_release(&g_lock);
+    lock->stat = stat;
+}
+
+void lockstat_acquired(volatile spinlock_t *lock, void *site, uint64_t spin_start) {
+    lockstat_t *stat = lock->stat;
+    uint64_t now = arch_time_counter();
+    __atomic_fetch_add(&stat->acquisitions, 1, __ATOMIC_RELAXED);
+    if(spin_start != 0) {
+        __atomic_fetch_add(&stat->contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stat->spin_time, now - spin_start, __ATOMIC_RELAXED);
+    }
+
+    lockstat_site_t *site_stat = site != NULL ? site_get(stat, site) : NULL;
+    if(site_stat != NULL) {
+        __atomic_fetch_add(&site_stat->acquisitions, 1, __ATOMIC_RELAXED);
+        if(spin_start != 0) {
+            __atomic_fetch_add(&site_stat->contended, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&site_stat->spin_time, now - spin_start, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Only the holder touches these
+    lock->hold_start = now;
+    lock->hold_site = site;
+}
+
+void lockstat_released(volatile spinlock_t *lock) {
+    max_update(&lock->stat->hold_max, &lock->stat->hold_max_site, arch_time_counter() - lock->hold_start, lock->hold_site);
+}
+#endif
+
+size_t lockstat_sorted([[maybe_unused]] lockstat_t **stats, [[maybe_unused]] size_t count) {
+    size_t filled = 0;
+#if LOCKSTAT
+    // Insertion sort keeping the most contended, there are only a handful of registered names
+    size_t stat_count = __atomic_load_n(&g_stat_count, __ATOMIC_ACQUIRE);
+    for(size_t i = 0; i < stat_count; i++) {
+        uint64_t contended = __atomic_load_n(&g_stats[i].contended, __ATOMIC_RELAXED);
+        size_t j = filled < count ? filled++ : count;
+        for(; j > 0 && __atomic_load_n(&stats[j - 1]->contended, __ATOMIC_RELAXED) < contended; j--) {
+            if(j < count) stats[j] = stats[j - 1];
+        }
+        if(j < count) stats[j] = &g_stats[i];
+    }
+#endif
+    return filled;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define LOCKSTAT false /* Profile registered spinlocks, every acquire and release of one reads the time counter */
+#define LOCKSTAT_MAX_LOCKS 32
+#define LOCKSTAT_SITES 8
+
+typedef struct {
+    void *site; // Return address of the spinlock_acquire call
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t spin_time;
+} lockstat_site_t;
+
+/* Shared by every lock registered under the same name, updated with relaxed atomics */
+typedef struct lockstat {
+    const char *name;
+    uint64_t acquisitions;
+    uint64_t contended; // Acquisitions that had to wait for another holder
+    uint64_t spin_time; // Nanoseconds spent waiting
+    uint64_t hold_max; // Longest hold in nanoseconds
+    void *hold_max_site;
+    lockstat_site_t sites[LOCKSTAT_SITES]; // First call sites seen, later ones only count towards the totals
+} lockstat_t;
+
+struct spinlock;
+
+#if LOCKSTAT
+/**
+ * @brief Profile a lock, locks registered under the same name share their statistics
+ * @warning Reinitializing the lock with SPINLOCK_INIT drops the registration
+ */
+void lockstat_register(volatile struct spinlock *lock, const char *name);
+
+/**
+ * @brief Record an acquisition of a registered lock
+ * @param site call site, NULL for try acquisitions
+ * @param spin_start time counter when the lock was found held, 0 if it was not contended
+ */
+void lockstat_acquired(volatile struct spinlock *lock, void *site, uint64_t spin_start);
+
+/**
+ * @brief Record the release of a registered lock
+ */
+void lockstat_released(volatile struct spinlock *lock);
+#else
+static inline void lockstat_register([[maybe_unused]] volatile struct spinlock *lock, [[maybe_unused]] const char *name) { }
+#endif
+
+/**
+ * @brief Get the registered statistics, most contended first
+ * @param stats array to fill
+ * @param count size of the array
+ * @returns number of entries filled
+ */
+size_t lockstat_sorted(lockstat_t **stats, size_t count);
@@ -1,19 +1,22 @@
 #include "log.h"
 #include <lib/format.h>
+#include <sched/rcu.h>
 
-static spinlock_t g_lock = SPINLOCK_INIT;
+/* Sinks are read under RCU, so loggers on different CPUs only contend on the sinks themselves */
+static spinlock_t g_lock = SPINLOCK_INIT; // Serializes sink list updates
 static list_t g_sinks = LIST_INIT;
 
 void log_sink_add(log_sink_t *sink) {
     spinlock_acquire(&g_lock);
-    list_append(&g_sinks, &sink->list_elem);
+    rcu_list_append(&g_sinks, &sink->list_elem);
     spinlock_release(&g_lock);
 }
 
 void log_sink_remove(log_sink_t *sink) {
     spinlock_acquire(&g_lock);
-    list_delete(&sink->list_elem);
+    rcu_list_delete(&sink->list_elem);
     spinlock_release(&g_lock);
+    rcu_synchronize();
 }
 
 void log(log_level_t level, const char *tag, const char *fmt, ...) {
@@ -25,23 +28,28 @@ void log(log_level_t level, const char *tag, const char *fmt, ...) {
 
 void log_list(log_level_t level, const char *tag, const char *fmt, va_list list) {
     va_list local_list;
-    spinlock_acquire(&g_lock);
-    LIST_FOREACH(&g_sinks, elem) {
+    rcu_read_lock();
+    RCU_LIST_FOREACH(&g_sinks, elem) {
         log_sink_t *sink = LIST_CONTAINER_GET(elem, log_sink_t, list_elem);
         if(sink->level > level) continue;
-	    va_copy(local_list, list);
+        va_copy(local_list, list);
+        spinlock_acquire(&sink->lock);
         sink->log(level, tag, fmt, local_list);
+        spinlock_release(&sink->lock);
         va_end(local_list);
     }
-    spinlock_release(&g_lock);
+    rcu_read_unlock();
 }
 
 void log_raw(char c) {
-    spinlock_acquire(&g_lock);
-    LIST_FOREACH(&g_sinks, elem) {
-        LIST_CONTAINER_GET(elem, log_sink_t, list_elem)->log_raw(c);
+    rcu_read_lock();
+    RCU_LIST_FOREACH(&g_sinks, elem) {
+        log_sink_t *sink = LIST_CONTAINER_GET(elem, log_sink_t, list_elem);
+        spinlock_acquire(&sink->lock);
+        sink->log_raw(c);
+        spinlock_release(&sink->lock);
     }
-    spinlock_release(&g_lock);
+    rcu_read_unlock();
 }
 
 const char *log_level_tostring(log_level_t level) {
@@ -15,6 +15,7 @@ typedef enum {
 typedef struct {
     char *name;
     log_level_t level;
+    spinlock_t lock; // Serializes output to this sink, zeroed is unlocked
     list_element_t list_elem;
 
     /**
@@ -36,6 +37,7 @@ void log_sink_add(log_sink_t *sink);
 
 /**
  * @brief Remove a log sink
+ * @note Waits for loggers still using the sink
  */
 void log_sink_remove(log_sink_t *sink);
 
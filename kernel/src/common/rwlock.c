@@ -0,0 +1,34 @@
+#include "rwlock.h"
+#include <common/assert.h>
+#include <arch/cpu.h>
+
+#define DEADLOCK_AT 100000000
+
+static inline bool writer_active(volatile rwlock_t *lock) {
+    uint32_t value = __atomic_load_n(&lock->writer.value, __ATOMIC_SEQ_CST);
+    return (uint16_t) value != (uint16_t) (value >> 16);
+}
+
+void rwlock_read_acquire(volatile rwlock_t *lock) {
+    preempt_disable();
+    uint64_t dead = 0;
+    while(true) {
+        // Announce first, a writer that got the lock before this is seen below and one after waits for the count
+        __atomic_fetch_add(&lock->readers, 1, __ATOMIC_SEQ_CST);
+        if(!writer_active(lock)) return;
+        __atomic_fetch_sub(&lock->readers, 1, __ATOMIC_RELAXED);
+        while(writer_active(lock)) {
+            arch_cpu_relax();
+            ASSERT(dead++ != DEADLOCK_AT);
+        }
+    }
+}
+
+void rwlock_write_acquire(volatile rwlock_t *lock) {
+    spinlock_acquire(&lock->writer);
+    uint64_t dead = 0;
+    while(__atomic_load_n(&lock->readers, __ATOMIC_SEQ_CST) != 0) {
+        arch_cpu_relax();
+        ASSERT(dead++ != DEADLOCK_AT);
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <stdint.h>
+#include <common/spinlock.h>
+
+#define RWLOCK_INIT ((rwlock_t) { .writer = {}, .readers = 0 })
+
+/*
+    Reader-writer spinlock, readers only share a counter and never wait on each other.
+    Writers take the inner ticket lock first and then drain the readers, new readers back off
+    while a writer holds or waits for it, so writers do not starve.
+*/
+typedef struct {
+    spinlock_t writer; // Held by the writer, register this one for lockstat
+    uint32_t readers;
+} rwlock_t;
+
+/**
+ * @brief Acquire a rwlock shared, preemption stays disabled until it is released
+ * @warning Spins until acquired, a reader must not upgrade to a writer
+ */
+void rwlock_read_acquire(volatile rwlock_t *lock);
+
+/**
+ * @brief Release a rwlock acquired shared
+ */
+static inline void rwlock_read_release(volatile rwlock_t *lock) {
+    __atomic_fetch_sub(&lock->readers, 1, __ATOMIC_RELEASE);
+    preempt_enable();
+}
+
+/**
+ * @brief Acquire a rwlock exclusive, preemption stays disabled until it is released
+ * @warning Spins until acquired
+ */
+void rwlock_write_acquire(volatile rwlock_t *lock);
+
+/**
+ * @brief Release a rwlock acquired exclusive
+ */
+static inline void rwlock_write_release(volatile rwlock_t *lock) {
+    spinlock_release(&lock->writer);
+}
@@ -2,17 +2,27 @@
 #include <stdint.h>
 #include <common/assert.h>
 #include <arch/cpu.h>
+#include <arch/time.h>
 
 #define DEADLOCK_AT 100000000
 
 void spinlock_acquire(volatile spinlock_t *lock) {
-    uint64_t dead = 0;
-    for(;;) {
-        if(spinlock_try_acquire(lock)) return;
+    // A waiter holding a ticket would stall everyone queued behind it, so it is not preemptible either
+    preempt_disable();
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+
+#if LOCKSTAT
+    uint64_t spin_start = 0;
+    if(lock->stat != NULL && __atomic_load_n(&lock->owner, __ATOMIC_RELAXED) != ticket) spin_start = arch_time_counter();
+#endif
 
-        while(__atomic_load_n(lock, __ATOMIC_RELAXED)) {
-            arch_cpu_relax();
-            ASSERT(dead++ != DEADLOCK_AT);
-        }
+    uint64_t dead = 0;
+    while(__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        arch_cpu_relax();
+        ASSERT(dead++ != DEADLOCK_AT);
     }
-}
\ No newline at end of file
+
+#if LOCKSTAT
+    if(lock->stat != NULL) lockstat_acquired(lock, __builtin_return_address(0), spin_start);
+#endif
+}
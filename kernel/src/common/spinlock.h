@@ -1,11 +1,37 @@
 #pragma once
+#include <stdint.h>
+#include <common/lockstat.h>
+#include <sched/preempt.h>
+#include <sys/ipl.h>
 
-#define SPINLOCK_INIT 0
+#define SPINLOCK_INIT ((spinlock_t) { .value = 0 })
 
-typedef bool spinlock_t;
+/*
+    Ticket lock, waiters are served in the order they arrived.
+    Acquiring only writes the cache line once, waiters then just read it until the owner hands over.
+    A zeroed lock is unlocked, so `{}` works where SPINLOCK_INIT cannot be nested in a constant initializer.
+*/
+typedef struct spinlock {
+    union {
+        uint32_t value;
+        struct {
+            uint16_t owner; // Ticket currently holding the lock
+            uint16_t next; // Ticket handed out to the next waiter
+        };
+    };
+#if LOCKSTAT
+    lockstat_t *stat; // NULL unless registered with lockstat_register
+    uint64_t hold_start;
+    void *hold_site;
+#endif
+} spinlock_t;
+
+#if !LOCKSTAT
+static_assert(sizeof(spinlock_t) == sizeof(uint32_t));
+#endif
 
 /**
- * @brief Acquire a spinlock
+ * @brief Acquire a spinlock, preemption stays disabled until it is released
  * @warning Spins until acquired
  */
 void spinlock_acquire(volatile spinlock_t *lock);
@@ -16,12 +42,47 @@ void spinlock_acquire(volatile spinlock_t *lock);
  * @returns true = acquired the lock
  */
 static inline bool spinlock_try_acquire(volatile spinlock_t *lock) {
-    return  !__atomic_test_and_set(lock, __ATOMIC_ACQUIRE);
+    preempt_disable();
+    uint32_t old = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+    // Free when owner equals next, taking the next ticket claims it
+    if((uint16_t) old == (uint16_t) (old >> 16) && __atomic_compare_exchange_n(&lock->value, &old, old + (1u << 16), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+#if LOCKSTAT
+        if(lock->stat != NULL) lockstat_acquired(lock, NULL, 0);
+#endif
+        return true;
+    }
+    preempt_enable();
+    return false;
 }
 
 /**
  * @brief Release a spinlock
  */
 static inline void spinlock_release(volatile spinlock_t *lock) {
-    __atomic_clear(lock, __ATOMIC_RELEASE);
-}
\ No newline at end of file
+#if LOCKSTAT
+    if(lock->stat != NULL) lockstat_released(lock);
+#endif
+    // Only the holder writes the owner half
+    __atomic_store_n(&lock->owner, (uint16_t) (__atomic_load_n(&lock->owner, __ATOMIC_RELAXED) + 1), __ATOMIC_RELEASE);
+    preempt_enable();
+}
+
+/**
+ * @brief Acquire a spinlock at IPL critical
+ * @note For locks also taken by interrupt handlers, an interrupt on the same CPU would otherwise spin on its own lock
+ * @returns ipl to restore on release
+ */
+static inline ipl_t spinlock_acquire_irqsave(volatile spinlock_t *lock) {
+    ipl_t old_ipl = ipl(IPL_CRITICAL);
+    spinlock_acquire(lock);
+    return old_ipl;
+}
+
+/**
+ * @brief Release a spinlock acquired with spinlock_acquire_irqsave
+ * @param old_ipl ipl returned when acquiring
+ */
+static inline void spinlock_release_irqrestore(volatile spinlock_t *lock, ipl_t old_ipl) {
+    spinlock_release(lock);
+    ipl(old_ipl);
+}
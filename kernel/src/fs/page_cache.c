@@ -0,0 +1,209 @@
+#include "page_cache.h"
+#include <lib/list.h>
+#include <lib/mem.h>
+#include <lib/container.h>
+#include <common/assert.h>
+#include <common/spinlock.h>
+#include <memory/heap.h>
+#include <memory/pmm.h>
+#include <memory/hhdm.h>
+#include <arch/types.h>
+
+#define CACHED_PAGE_INTERSECTS(CACHED, OFFSET, SIZE) ((CACHED)->offset < (OFFSET) + (SIZE) && (OFFSET) < (CACHED)->offset + ARCH_PAGE_SIZE)
+
+typedef struct {
+    size_t offset;
+    pmm_page_t *page;
+    list_element_t list_elem;
+} cached_page_t;
+
+typedef enum {
+    COPY_FROM_CACHE,
+    COPY_TO_CACHE
+} copy_direction_t;
+
+// OPTIMIZE: pages are looked up linearly, a tree keyed on offset would scale better for large files
+/** @warning Assumes lock is acquired */
+static cached_page_t *find_page(vfs_node_t *node, size_t offset) {
+    LIST_FOREACH(&node->page_cache.pages, elem) {
+        cached_page_t *cached = LIST_CONTAINER_GET(elem, cached_page_t, list_elem);
+        if(cached->offset == offset) return cached;
+    }
+    return NULL;
+}
+
+static void page_put(pmm_page_t *page) {
+    if(__atomic_sub_fetch(&page->refcount, 1, __ATOMIC_ACQ_REL) == 0) pmm_free(page);
+}
+
+/** @brief Free pages taken off a node, mapped ones live on until their mappings are gone */
+static void drop_pages(list_t *dropped) {
+    for(list_element_t *elem = dropped->next, *next; elem != NULL && elem != dropped; elem = next) {
+        next = LIST_NEXT(elem);
+        cached_page_t *cached = LIST_CONTAINER_GET(elem, cached_page_t, list_elem);
+        page_put(cached->page);
+        heap_free(cached);
+    }
+}
+
+static void copy_range(vfs_node_t *node, size_t offset, size_t size, void *buffer, copy_direction_t direction) {
+    spinlock_acquire(&node->page_cache.lock);
+    LIST_FOREACH(&node->page_cache.pages, elem) {
+        cached_page_t *cached = LIST_CONTAINER_GET(elem, cached_page_t, list_elem);
+        if(!CACHED_PAGE_INTERSECTS(cached, offset, size)) continue;
+
+        size_t start = cached->offset > offset ? cached->offset : offset;
+        size_t end = cached->offset + ARCH_PAGE_SIZE < offset + size ? cached->offset + ARCH_PAGE_SIZE : offset + size;
+        void *page_data = (void *) HHDM(cached->page->paddr + (start - cached->offset));
+        void *buffer_data = buffer + (start - offset);
+        switch(direction) {
+            case COPY_FROM_CACHE: memcpy(buffer_data, page_data, end - start); break;
+            case COPY_TO_CACHE: memcpy(page_data, buffer_data, end - start); break;
+        }
+    }
+    spinlock_release(&node->page_cache.lock);
+}
+
+int page_cache_get(vfs_node_t *node, size_t offset, uintptr_t *out) {
+    ASSERT(offset % ARCH_PAGE_SIZE == 0);
+    spinlock_acquire(&node->page_cache.lock);
+    cached_page_t *cached = find_page(node, offset);
+    if(cached != NULL) {
+        __atomic_add_fetch(&cached->page->refcount, 1, __ATOMIC_ACQ_REL);
+        *out = cached->page->paddr;
+    }
+    spinlock_release(&node->page_cache.lock);
+    if(cached != NULL) return 0;
+
+    pmm_page_t *page = pmm_alloc_page(PMM_STANDARD | PMM_FLAG_ZERO);
+    size_t read_count = 0;
+    int r = node->ops->rw(node, &(vfs_rw_t) {
+        .rw = VFS_RW_READ,
+        .buffer = (void *) HHDM(page->paddr),
+        .size = ARCH_PAGE_SIZE,
+        .offset = offset
+    }, &read_count);
+    if(r != 0) {
+        pmm_free(page);
+        return r;
+    }
+
+    // Another thread might have read in the same page meanwhile, the first one to insert it wins
+    spinlock_acquire(&node->page_cache.lock);
+    cached = find_page(node, offset);
+    if(cached == NULL) {
+        page->refcount = 1; // Reference held by the cache itself
+        cached = heap_alloc(sizeof(cached_page_t));
+        cached->offset = offset;
+        cached->page = page;
+        list_append(&node->page_cache.pages, &cached->list_elem);
+        page = NULL;
+    }
+    __atomic_add_fetch(&cached->page->refcount, 1, __ATOMIC_ACQ_REL);
+    *out = cached->page->paddr;
+    spinlock_release(&node->page_cache.lock);
+    if(page != NULL) pmm_free(page);
+    return 0;
+}
+
+void page_cache_read(vfs_node_t *node, size_t offset, size_t size, void *buffer) {
+    copy_range(node, offset, size, buffer, COPY_FROM_CACHE);
+}
+
+void page_cache_write(vfs_node_t *node, size_t offset, size_t size, void *buffer) {
+    copy_range(node, offset, size, buffer, COPY_TO_CACHE);
+}
+
+void page_cache_truncate(vfs_node_t *node, size_t length) {
+    list_t dropped = LIST_INIT;
+    spinlock_acquire(&node->page_cache.lock);
+    for(list_element_t *elem = node->page_cache.pages.next, *next; elem != NULL && elem != &node->page_cache.pages; elem = next) {
+        next = LIST_NEXT(elem);
+        cached_page_t *cached = LIST_CONTAINER_GET(elem, cached_page_t, list_elem);
+        if(cached->offset + ARCH_PAGE_SIZE <= length) continue;
+        if(cached->offset >= length) {
+            list_delete(elem);
+            list_append(&dropped, elem);
+            continue;
+        }
+        memset((void *) HHDM(cached->page->paddr + (length - cached->offset)), 0, ARCH_PAGE_SIZE - (length - cached->offset));
+    }
+    spinlock_release(&node->page_cache.lock);
+    drop_pages(&dropped);
+}
+
+int page_cache_sync(vfs_node_t *node) {
+    vfs_node_attr_t attr;
+    int r = node->ops->attr(node, &attr);
+    if(r != 0) return r;
+
+    // OPTIMIZE: every step searches the list for the next page, the lock is dropped in between and pages might be removed meanwhile
+    for(size_t offset = 0; offset < attr.size;) {
+        spinlock_acquire(&node->page_cache.lock);
+        cached_page_t *next = NULL;
+        LIST_FOREACH(&node->page_cache.pages, elem) {
+            cached_page_t *cached = LIST_CONTAINER_GET(elem, cached_page_t, list_elem);
+            if(cached->offset >= offset && (next == NULL || cached->offset < next->offset)) next = cached;
+        }
+        pmm_page_t *page = NULL;
+        if(next != NULL) {
+            page = next->page;
+            offset = next->offset;
+            __atomic_add_fetch(&page->refcount, 1, __ATOMIC_ACQ_REL);
+        }
+        spinlock_release(&node->page_cache.lock);
+        if(page == NULL) break;
+
+        if(offset < attr.size) {
+            size_t write_count = 0;
+            r = node->ops->rw(node, &(vfs_rw_t) {
+                .rw = VFS_RW_WRITE,
+                .buffer = (void *) HHDM(page->paddr),
+                .size = attr.size - offset < ARCH_PAGE_SIZE ? attr.size - offset : ARCH_PAGE_SIZE,
+                .offset = offset
+            }, &write_count);
+        }
+        page_put(page);
+        if(r != 0) break;
+        offset += ARCH_PAGE_SIZE;
+    }
+    return r;
+}
+
+static void sync_work(work_t *work) {
+    vfs_node_t *node = CONTAINER_OF(work, vfs_node_t, page_cache.sync_work);
+    // Cleared first, writes to the cache after this point are covered by the next sync
+    __atomic_store_n(&node->page_cache.sync_queued, false, __ATOMIC_SEQ_CST);
+    page_cache_sync(node);
+    if(__atomic_load_n(&node->refcount, __ATOMIC_SEQ_CST) != 0) return;
+
+    /*
+        Whoever unmaps a shared mapping queues a sync before dropping its node reference. Seeing no reference
+        and no queued sync therefore means everything written to the cache was written back above.
+    */
+    list_t dropped = LIST_INIT;
+    spinlock_acquire(&node->page_cache.lock);
+    if(__atomic_load_n(&node->refcount, __ATOMIC_SEQ_CST) == 0 && !__atomic_load_n(&node->page_cache.sync_queued, __ATOMIC_SEQ_CST)) {
+        for(list_element_t *elem = node->page_cache.pages.next, *next; elem != NULL && elem != &node->page_cache.pages; elem = next) {
+            next = LIST_NEXT(elem);
+            list_delete(elem);
+            list_append(&dropped, elem);
+        }
+    }
+    spinlock_release(&node->page_cache.lock);
+    drop_pages(&dropped);
+}
+
+void page_cache_sync_deferred(vfs_node_t *node) {
+    bool queued = false;
+    if(!__atomic_compare_exchange_n(&node->page_cache.sync_queued, &queued, true, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return;
+    node->page_cache.sync_work = WORK_INIT(sync_work);
+    work_queue(&node->page_cache.sync_work);
+}
+
+void page_cache_release(vfs_node_t *node) {
+    spinlock_acquire(&node->page_cache.lock);
+    bool empty = list_is_empty(&node->page_cache.pages);
+    spinlock_release(&node->page_cache.lock);
+    if(!empty) page_cache_sync_deferred(node);
+}
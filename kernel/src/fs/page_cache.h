@@ -0,0 +1,53 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <fs/vfs.h>
+
+/*
+    The cache lock is a spinlock and file systems may block, node operations are therefore never called with it held.
+    Pages are dropped past the end of a truncated node and, once the node is no longer referenced (see vfs_node_unref),
+    all of them after a final write back. Mappings keep their own reference on a page, dropping it only detaches it from the cache.
+*/
+
+/**
+ * @brief Retrieve the page caching an offset of a node, reading it in if it is not cached
+ * @param offset page aligned offset
+ * @param out physical address of the page, a reference is taken on behalf of the caller
+ * @returns 0 on success, -errno on failure
+ * @warning Calls into the file system, must not be called with a spinlock held
+ */
+int page_cache_get(vfs_node_t *node, size_t offset, uintptr_t *out);
+
+/**
+ * @brief Overlay cached pages onto data read from a node
+ */
+void page_cache_read(vfs_node_t *node, size_t offset, size_t size, void *buffer);
+
+/**
+ * @brief Update cached pages with data written to a node
+ */
+void page_cache_write(vfs_node_t *node, size_t offset, size_t size, void *buffer);
+
+/**
+ * @brief Drop cached pages past the end of a truncated node and zero the tail of the last one
+ */
+void page_cache_truncate(vfs_node_t *node, size_t length);
+
+/**
+ * @brief Write cached pages back to a node
+ * @returns 0 on success, -errno on failure
+ * @warning Calls into the file system, must not be called with a spinlock held
+ */
+int page_cache_sync(vfs_node_t *node);
+
+/**
+ * @brief Write cached pages back to a node from a worker thread, for callers that hold spinlocks
+ * @note A sync that is already queued but has not started yet covers this request too
+ */
+void page_cache_sync_deferred(vfs_node_t *node);
+
+/**
+ * @brief Write back and drop the cached pages of a node that lost its last reference, from a worker thread
+ * @note Pages are kept if the node is referenced again or more writes are queued before the worker gets to it
+ */
+void page_cache_release(vfs_node_t *node);
\ No newline at end of file
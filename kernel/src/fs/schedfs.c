@@ -0,0 +1,312 @@
+#include "schedfs.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <lib/str.h>
+#include <lib/mem.h>
+#include <lib/format.h>
+#include <common/lockstat.h>
+#include <memory/heap.h>
+#include <sched/sched.h>
+#include <sched/mutex.h>
+#include <sched/thread.h>
+#include <sched/stats.h>
+#include <sys/cpu.h>
+
+#define NODES(VFS) ((schedfs_nodes_t *) (VFS)->data)
+#define RENDER_INITIAL_SIZE 4096
+
+typedef struct {
+    vfs_node_t *root;
+    vfs_node_t *cpus;
+    vfs_node_t *threads;
+    vfs_node_t *locks;
+} schedfs_nodes_t;
+
+/*
+    Files are rendered in full on every read. format has no output context,
+    so the output buffer is global and rendering is serialized.
+*/
+static mutex_t g_render_lock = MUTEX_INIT(g_render_lock);
+static char *g_render_buffer;
+static size_t g_render_size;
+static size_t g_render_length;
+
+static void render_out(char ch) {
+    if(g_render_length < g_render_size) g_render_buffer[g_render_length] = ch;
+    g_render_length++;
+}
+
+static void render(const char *fmt, ...) {
+    va_list list;
+    va_start(list, fmt);
+    format(render_out, fmt, list);
+    va_end(list);
+}
+
+static void render_histogram(const char *name, sched_histogram_t *histogram) {
+    render("%s:\n", name);
+    for(size_t i = 0; i < SCHED_HISTOGRAM_BUCKETS; i++) {
+        uint64_t count = __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        if(count == 0) continue;
+        if(i == SCHED_HISTOGRAM_BUCKETS - 1) {
+            render("  [%lu, ...) %lu\n", 1ul << i, count);
+        } else {
+            render("  [%lu, %lu) %lu\n", i == 0 ? 0 : 1ul << i, 1ul << (i + 1), count);
+        }
+    }
+}
+
+static void render_cpus() {
+    cpu_t *cpu;
+    for(size_t i = 0; (cpu = sched_cpu(i)) != NULL; i++) {
+        render(
+            "cpu %lu: voluntary %lu, involuntary %lu, migrations %lu\n",
+            cpu->id,
+            __atomic_load_n(&cpu->stats.voluntary, __ATOMIC_RELAXED),
+            __atomic_load_n(&cpu->stats.involuntary, __ATOMIC_RELAXED),
+            __atomic_load_n(&cpu->stats.migrations, __ATOMIC_RELAXED)
+        );
+        render_histogram("latency_ns", &cpu->stats.latency);
+        render_histogram("slice_ns", &cpu->stats.slice);
+    }
+}
+
+static void render_thread(thread_t *thread, [[maybe_unused]] void *data) {
+    uint64_t runs = __atomic_load_n(&thread->stats.runs, __ATOMIC_RELAXED);
+    uint64_t latency_total = __atomic_load_n(&thread->stats.latency_total, __ATOMIC_RELAXED);
+    render(
+        "%li %li %lu %lu %lu %lu %lu %lu\n",
+        thread->proc->id,
+        thread->id,
+        runs,
+        __atomic_load_n(&thread->stats.voluntary, __ATOMIC_RELAXED),
+        __atomic_load_n(&thread->stats.involuntary, __ATOMIC_RELAXED),
+        __atomic_load_n(&thread->stats.migrations, __ATOMIC_RELAXED),
+        runs == 0 ? 0 : latency_total / runs,
+        __atomic_load_n(&thread->stats.latency_max, __ATOMIC_RELAXED)
+    );
+}
+
+static void render_threads() {
+    render("pid tid runs voluntary involuntary migrations latency_avg_ns latency_max_ns\n");
+    sched_thread_foreach(render_thread, NULL);
+}
+
+static void render_locks() {
+    if(!LOCKSTAT) return render("lockstat disabled, see LOCKSTAT in common/lockstat.h\n");
+
+    lockstat_t *stats[LOCKSTAT_MAX_LOCKS];
+    size_t count = lockstat_sorted(stats, LOCKSTAT_MAX_LOCKS);
+    render("name acquisitions contended spin_ns hold_max_ns hold_max_site\n");
+    for(size_t i = 0; i < count; i++) {
+        lockstat_t *stat = stats[i];
+        render(
+            "%s %lu %lu %lu %lu %#lx\n",
+            stat->name,
+            __atomic_load_n(&stat->acquisitions, __ATOMIC_RELAXED),
+            __atomic_load_n(&stat->contended, __ATOMIC_RELAXED),
+            __atomic_load_n(&stat->spin_time, __ATOMIC_RELAXED),
+            __atomic_load_n(&stat->hold_max, __ATOMIC_RELAXED),
+            (uintptr_t) __atomic_load_n(&stat->hold_max_site, __ATOMIC_RELAXED)
+        );
+        for(size_t j = 0; j < LOCKSTAT_SITES; j++) {
+            lockstat_site_t *site = &stat->sites[j];
+            if(__atomic_load_n(&site->site, __ATOMIC_RELAXED) == NULL) break;
+            render(
+                "  %#lx %lu %lu %lu\n",
+                (uintptr_t) site->site,
+                __atomic_load_n(&site->acquisitions, __ATOMIC_RELAXED),
+                __atomic_load_n(&site->contended, __ATOMIC_RELAXED),
+                __atomic_load_n(&site->spin_time, __ATOMIC_RELAXED)
+            );
+        }
+    }
+}
+
+static int schedfs_file_rw(vfs_node_t *node, vfs_rw_t *packet, size_t *rw_count) {
+    if(packet->rw == VFS_RW_WRITE) return -EPERM;
+
+    mutex_acquire(&g_render_lock);
+    g_render_size = RENDER_INITIAL_SIZE;
+    while(true) {
+        g_render_buffer = heap_alloc(g_render_size);
+        g_render_length = 0;
+        if(node == NODES(node->vfs)->cpus) {
+            render_cpus();
+        } else if(node == NODES(node->vfs)->locks) {
+            render_locks();
+        } else {
+            render_threads();
+        }
+        if(g_render_length <= g_render_size) break;
+        // Truncated, retry with room for what was missed and whatever was added in the meantime
+        heap_free(g_render_buffer);
+        g_render_size = g_render_length * 2;
+    }
+
+    size_t count = 0;
+    if(packet->offset < g_render_length) {
+        count = g_render_length - packet->offset;
+        if(count > packet->size) count = packet->size;
+        memcpy(packet->buffer, g_render_buffer + packet->offset, count);
+    }
+    heap_free(g_render_buffer);
+    mutex_release(&g_render_lock);
+
+    *rw_count = count;
+    return 0;
+}
+
+static int schedfs_file_attr(vfs_node_t *node [[maybe_unused]], vfs_node_attr_t *attr) {
+    attr->size = 0;
+    return 0;
+}
+
+static const char *schedfs_file_name(vfs_node_t *node) {
+    if(node == NODES(node->vfs)->cpus) return "cpus";
+    if(node == NODES(node->vfs)->locks) return "locks";
+    return "threads";
+}
+
+static int schedfs_file_lookup(vfs_node_t *node [[maybe_unused]], char *name [[maybe_unused]], vfs_node_t **out [[maybe_unused]]) {
+    return -ENOTDIR;
+}
+
+static int schedfs_file_readdir(vfs_node_t *node [[maybe_unused]], int *offset [[maybe_unused]], char **out [[maybe_unused]]) {
+    return -ENOTDIR;
+}
+
+static int schedfs_file_mkdir(vfs_node_t *node [[maybe_unused]], const char *name [[maybe_unused]], vfs_node_t **out [[maybe_unused]]) {
+    return -ENOTDIR;
+}
+
+static int schedfs_file_create(vfs_node_t *node [[maybe_unused]], const char *name [[maybe_unused]], vfs_node_t **out [[maybe_unused]]) {
+    return -ENOTDIR;
+}
+
+static int schedfs_file_truncate(vfs_node_t *node [[maybe_unused]], size_t length [[maybe_unused]]) {
+    return -EPERM;
+}
+
+static vfs_node_ops_t g_file_ops = {
+    .attr = schedfs_file_attr,
+    .name = schedfs_file_name,
+    .lookup = schedfs_file_lookup,
+    .rw = schedfs_file_rw,
+    .mkdir = schedfs_file_mkdir,
+    .readdir = schedfs_file_readdir,
+    .create = schedfs_file_create,
+    .truncate = schedfs_file_truncate
+};
+
+static int schedfs_root_attr(vfs_node_t *node [[maybe_unused]], vfs_node_attr_t *attr) {
+    attr->device_id = 0;
+    attr->inode = 0;
+    attr->size = 0;
+    attr->block_count = 0;
+    attr->block_size = 0;
+    return 0;
+}
+
+static const char *schedfs_root_name(vfs_node_t *node [[maybe_unused]]) {
+    return NULL;
+}
+
+static int schedfs_root_lookup(vfs_node_t *node, char *name, vfs_node_t **out) {
+    if(strcmp(name, "..") == 0) {
+        *out = NULL;
+        return 0;
+    }
+    if(strcmp(name, ".") == 0) {
+        *out = node;
+        return 0;
+    }
+    if(strcmp(name, "cpus") == 0) {
+        *out = NODES(node->vfs)->cpus;
+        return 0;
+    }
+    if(strcmp(name, "threads") == 0) {
+        *out = NODES(node->vfs)->threads;
+        return 0;
+    }
+    if(strcmp(name, "locks") == 0) {
+        *out = NODES(node->vfs)->locks;
+        return 0;
+    }
+    return -ENOENT;
+}
+
+static int schedfs_root_rw(vfs_node_t *node [[maybe_unused]], vfs_rw_t *packet [[maybe_unused]], size_t *rw_count [[maybe_unused]]) {
+    return -EISDIR;
+}
+
+static int schedfs_root_readdir(vfs_node_t *node [[maybe_unused]], int *offset, char **out) {
+    switch(*offset) {
+        case 0:
+            *out = "cpus";
+            break;
+        case 1:
+            *out = "threads";
+            break;
+        case 2:
+            *out = "locks";
+            break;
+        default:
+            *out = NULL;
+            return 0;
+    }
+    (*offset)++;
+    return 0;
+}
+
+static int schedfs_root_mkdir(vfs_node_t *node [[maybe_unused]], const char *name [[maybe_unused]], vfs_node_t **out [[maybe_unused]]) {
+    return -EPERM;
+}
+
+static int schedfs_root_create(vfs_node_t *node [[maybe_unused]], const char *name [[maybe_unused]], vfs_node_t **out [[maybe_unused]]) {
+    return -EPERM;
+}
+
+static int schedfs_root_truncate(vfs_node_t *node [[maybe_unused]], size_t length [[maybe_unused]]) {
+    return -EISDIR;
+}
+
+static vfs_node_ops_t g_root_ops = {
+    .attr = schedfs_root_attr,
+    .name = schedfs_root_name,
+    .lookup = schedfs_root_lookup,
+    .rw = schedfs_root_rw,
+    .mkdir = schedfs_root_mkdir,
+    .readdir = schedfs_root_readdir,
+    .create = schedfs_root_create,
+    .truncate = schedfs_root_truncate
+};
+
+static vfs_node_t *create_node(vfs_t *vfs, vfs_node_type_t type, vfs_node_ops_t *ops) {
+    vfs_node_t *node = heap_alloc(sizeof(vfs_node_t));
+    memset(node, 0, sizeof(vfs_node_t));
+    node->vfs = vfs;
+    node->type = type;
+    node->ops = ops;
+    return node;
+}
+
+static int schedfs_mount(vfs_t *vfs, [[maybe_unused]] void *data) {
+    schedfs_nodes_t *nodes = heap_alloc(sizeof(schedfs_nodes_t));
+    nodes->root = create_node(vfs, VFS_NODE_TYPE_DIR, &g_root_ops);
+    nodes->cpus = create_node(vfs, VFS_NODE_TYPE_FILE, &g_file_ops);
+    nodes->threads = create_node(vfs, VFS_NODE_TYPE_FILE, &g_file_ops);
+    nodes->locks = create_node(vfs, VFS_NODE_TYPE_FILE, &g_file_ops);
+    vfs->data = (void *) nodes;
+    return 0;
+}
+
+static int schedfs_root(vfs_t *vfs, vfs_node_t **out) {
+    *out = NODES(vfs)->root;
+    return 0;
+}
+
+vfs_ops_t g_schedfs_ops = {
+    .mount = schedfs_mount,
+    .root = schedfs_root
+};
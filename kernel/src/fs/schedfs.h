@@ -0,0 +1,4 @@
+#pragma once
+#include <fs/vfs.h>
+
+extern vfs_ops_t g_schedfs_ops;
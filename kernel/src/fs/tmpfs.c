@@ -4,16 +4,19 @@
 #include <lib/str.h>
 #include <common/assert.h>
 #include <memory/heap.h>
+#include <sched/mutex.h>
 
 #define INFO(VFS) ((tmpfs_info_t *) (VFS)->data)
 #define TNODE(NODE) ((tmpfs_node_t *) (NODE)->data)
 
 typedef struct {
+    mutex_t lock; // Directory entries and the id counter
     struct tmpfs_node *root_dir;
     uint64_t id_counter;
 } tmpfs_info_t;
 
 typedef struct {
+    mutex_t lock; // Contents, growing a file copies all of it
     uintptr_t base;
     size_t size;
 } tmpfs_file_t;
@@ -34,6 +37,7 @@ typedef struct tmpfs_node {
 
 static vfs_node_ops_t g_node_ops;
 
+/** @warning Assumes the info lock is acquired */
 static tmpfs_node_t *dir_find(tmpfs_node_t *dir, const char *name) {
     tmpfs_node_t *node = dir->dir.children;
     while(node) {
@@ -43,6 +47,7 @@ static tmpfs_node_t *dir_find(tmpfs_node_t *dir, const char *name) {
     return 0;
 }
 
+/** @warning Assumes the info lock is acquired, unless the vfs is not mounted yet */
 static tmpfs_node_t *create_tnode(tmpfs_node_t *parent, vfs_t *vfs, bool is_dir, const char *name) {
     tmpfs_node_t *tnode = heap_alloc(sizeof(tmpfs_node_t));
     memset(tnode, 0, sizeof(tmpfs_node_t));
@@ -55,6 +60,7 @@ static tmpfs_node_t *create_tnode(tmpfs_node_t *parent, vfs_t *vfs, bool is_dir,
     if(!is_dir) {
         tmpfs_file_t *tfile = heap_alloc(sizeof(tmpfs_file_t));
         memset(tfile, 0, sizeof(tmpfs_file_t));
+        tfile->lock = MUTEX_INIT(tfile->lock);
         tnode->file = tfile;
     }
 
@@ -73,7 +79,7 @@ static int tmpfs_node_attr(vfs_node_t *node, vfs_node_attr_t *attr) {
     attr->device_id = 0; // TODO: set real device id
     attr->inode = TNODE(node)->id;
     attr->size = 0;
-    if(node->type == VFS_NODE_TYPE_FILE) attr->size = TNODE(node)->file->size;
+    if(node->type == VFS_NODE_TYPE_FILE) attr->size = __atomic_load_n(&TNODE(node)->file->size, __ATOMIC_RELAXED);
     attr->block_size = 1; // TODO: ensure this is not a terrible way of doing this
     attr->block_count = attr->size;
     return 0;
@@ -97,7 +103,9 @@ static int tmpfs_node_lookup(vfs_node_t *node, char *name, vfs_node_t **out) {
             *out = NULL;
         return 0;
     }
+    mutex_acquire(&INFO(node->vfs)->lock);
     tmpfs_node_t *tnode = dir_find((tmpfs_node_t *) node->data, name);
+    mutex_release(&INFO(node->vfs)->lock);
     if(!tnode) return -ENOENT;
     *out = tnode->node;
     return 0;
@@ -109,14 +117,15 @@ static int tmpfs_node_rw(vfs_node_t *node, vfs_rw_t *packet, size_t *rw_count) {
     tmpfs_file_t *tfile = (tmpfs_file_t *) TNODE(node)->file;
 
     *rw_count = 0;
+    mutex_acquire(&tfile->lock);
     switch(packet->rw) {
         case VFS_RW_READ:
-            if(packet->offset >= tfile->size) return 0;
+            if(packet->offset >= tfile->size) break;
             size_t count = tfile->size - packet->offset;
             if(count > packet->size) count = packet->size;
             memcpy(packet->buffer, (void *) (tfile->base + packet->offset), count);
             *rw_count = count;
-            return 0;
+            break;
         case VFS_RW_WRITE:
             if(packet->offset + packet->size > tfile->size) {
                 void *new_buf = heap_alloc(packet->offset + packet->size);
@@ -125,21 +134,24 @@ static int tmpfs_node_rw(vfs_node_t *node, vfs_rw_t *packet, size_t *rw_count) {
                     heap_free((void *) tfile->base);
                 }
                 tfile->base = (uintptr_t) new_buf;
-                tfile->size = packet->offset + packet->size;
+                __atomic_store_n(&tfile->size, packet->offset + packet->size, __ATOMIC_RELAXED);
             }
             memcpy((void *) (tfile->base + packet->offset), packet->buffer, packet->size);
             *rw_count = packet->size;
-            return 0;
+            break;
     }
+    mutex_release(&tfile->lock);
     return 0;
 }
 
 static int tmpfs_node_readdir(vfs_node_t *node, int *offset, char **out) {
     if(node->type != VFS_NODE_TYPE_DIR) return -ENOTDIR;
+    mutex_acquire(&INFO(node->vfs)->lock);
     tmpfs_node_t *tnode = TNODE(node)->dir.children;
     for(int i = 0; i < *offset && tnode; i++) tnode = tnode->sibling_next;
     if(tnode) *out = (char *) tnode->name;
     else *out = NULL;
+    mutex_release(&INFO(node->vfs)->lock);
     (*offset)++;
     return 0;
 }
@@ -147,8 +159,13 @@ static int tmpfs_node_readdir(vfs_node_t *node, int *offset, char **out) {
 static int tmpfs_node_mkdir(vfs_node_t *node, const char *name, vfs_node_t **out) {
     if(node->type != VFS_NODE_TYPE_DIR) return -ENOTDIR;
     tmpfs_node_t *tparent = TNODE(node);
-    if(dir_find(tparent, name)) return -EEXIST;
+    mutex_acquire(&INFO(node->vfs)->lock);
+    if(dir_find(tparent, name)) {
+        mutex_release(&INFO(node->vfs)->lock);
+        return -EEXIST;
+    }
     tmpfs_node_t *dir = create_tnode(tparent, node->vfs, true, name);
+    mutex_release(&INFO(node->vfs)->lock);
     *out = dir->node;
     return 0;
 }
@@ -156,31 +173,39 @@ static int tmpfs_node_mkdir(vfs_node_t *node, const char *name, vfs_node_t **out
 static int tmpfs_node_create(vfs_node_t *node, const char *name, vfs_node_t **out) {
     if(node->type != VFS_NODE_TYPE_DIR) return -ENOTDIR;
     tmpfs_node_t *tparent = TNODE(node);
-    if(dir_find(tparent, name)) return -EEXIST;
+    mutex_acquire(&INFO(node->vfs)->lock);
+    if(dir_find(tparent, name)) {
+        mutex_release(&INFO(node->vfs)->lock);
+        return -EEXIST;
+    }
     tmpfs_node_t *file = create_tnode(tparent, node->vfs, false, name);
+    mutex_release(&INFO(node->vfs)->lock);
     *out = file->node;
     return 0;
 }
 
 static int tmpfs_node_truncate(vfs_node_t *node, size_t length) {
     if(node->type != VFS_NODE_TYPE_FILE) return -EISDIR; // TODO: This errno for this assertion is not strictly correct
-    tmpfs_node_t *tnode = TNODE(node);
+    tmpfs_file_t *tfile = TNODE(node)->file;
+    mutex_acquire(&tfile->lock);
     void *buf;
     if(length > 0) {
         buf = heap_alloc(length);
         memset(buf, 0, length);
-        if((void *) tnode->file->base != NULL) memcpy(buf, (void *) tnode->file->base, tnode->file->size < length ? tnode->file->size : length);
+        if((void *) tfile->base != NULL) memcpy(buf, (void *) tfile->base, tfile->size < length ? tfile->size : length);
     } else {
         buf = NULL;
     }
-    if((void *) tnode->file->base != NULL) heap_free((void *) tnode->file->base);
-    tnode->file->base = (uintptr_t) buf;
-    tnode->file->size = length;
+    if((void *) tfile->base != NULL) heap_free((void *) tfile->base);
+    tfile->base = (uintptr_t) buf;
+    __atomic_store_n(&tfile->size, length, __ATOMIC_RELAXED);
+    mutex_release(&tfile->lock);
     return 0;
 }
 
 static int tmpfs_mount(vfs_t *vfs, [[maybe_unused]] void *data) {
     tmpfs_info_t *info = heap_alloc(sizeof(tmpfs_info_t));
+    info->lock = MUTEX_INIT(info->lock);
     info->id_counter = 1;
     vfs->data = (void *) info;
     info->root_dir = create_tnode(NULL, vfs, true, NULL);
@@ -5,43 +5,65 @@
 #include <common/log.h>
 #include <common/panic.h>
 #include <common/assert.h>
+#include <common/spinlock.h>
+#include <sched/rcu.h>
+#include <fs/page_cache.h>
 #include <memory/heap.h>
 
+/*
+    Mounts are never torn down, so the mount list and mount points are only published with release stores.
+    Path walks read them without taking a lock, only mounting itself is serialized.
+*/
 list_t g_vfs_all = LIST_INIT_CIRCULAR(g_vfs_all);
+static spinlock_t g_vfs_lock = SPINLOCK_INIT;
+
+void vfs_node_ref(vfs_node_t *node) {
+    __atomic_add_fetch(&node->refcount, 1, __ATOMIC_ACQ_REL);
+}
+
+void vfs_node_unref(vfs_node_t *node) {
+    if(__atomic_sub_fetch(&node->refcount, 1, __ATOMIC_SEQ_CST) == 0) page_cache_release(node);
+}
 
 int vfs_mount(vfs_ops_t *vfs_ops, char *path, void *data) {
     vfs_t *vfs = heap_alloc(sizeof(vfs_t));
     memset(vfs, 0, sizeof(vfs_t));
     vfs->ops = vfs_ops;
     vfs_ops->mount(vfs, data);
+    vfs_node_t *node = NULL;
     if(list_is_empty(&g_vfs_all)) {
         if(path != NULL) {
             heap_free(vfs);
             return -ENOENT;
         }
-        vfs->mount_node = NULL;
     } else {
-        vfs_node_t *node;
         int r = vfs_lookup(path, &node, NULL);
         if(r != 0) {
             heap_free(vfs);
             return r;
         }
+    }
+    vfs->mount_node = node;
+
+    spinlock_acquire(&g_vfs_lock);
+    if(node != NULL) {
         if(node->vfs_mounted != NULL) {
+            spinlock_release(&g_vfs_lock);
             heap_free(vfs);
             return -EBUSY;
         }
-        node->vfs_mounted = vfs;
-        vfs->mount_node = node;
+        RCU_ASSIGN(node->vfs_mounted, vfs);
     }
-    list_prepend(&g_vfs_all, &vfs->list_elem);
+    rcu_list_prepend(&g_vfs_all, &vfs->list_elem);
+    spinlock_release(&g_vfs_lock);
     return 0;
 }
 
 int vfs_root(vfs_node_t **out) {
-    if(list_is_empty(&g_vfs_all)) return -ENOENT;
-    ASSERT(LIST_NEXT(&g_vfs_all) != NULL);
-    vfs_t *vfs = LIST_CONTAINER_GET(LIST_NEXT(&g_vfs_all), vfs_t, list_elem);
+    list_element_t *first = RCU_DEREFERENCE(LIST_NEXT(&g_vfs_all));
+    if(first == &g_vfs_all) return -ENOENT;
+    ASSERT(first != NULL);
+    vfs_t *vfs = LIST_CONTAINER_GET(first, vfs_t, list_elem);
     return vfs->ops->root(vfs, out);
 }
 
@@ -106,8 +128,9 @@ int vfs_lookup_ext(char *path, vfs_node_t **out, vfs_node_t *cwd, vfs_lookup_cre
                 break;
         }
 
-        if(current_node->vfs_mounted == NULL) continue;
-        int r = current_node->vfs_mounted->ops->root(current_node->vfs_mounted, &current_node);
+        vfs_t *mounted = RCU_DEREFERENCE(current_node->vfs_mounted);
+        if(mounted == NULL) continue;
+        int r = mounted->ops->root(mounted, &current_node);
         if(r != 0) return r;
     } while(path[comp_end++]);
 
@@ -2,6 +2,8 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <lib/list.h>
+#include <common/spinlock.h>
+#include <sched/work.h>
 
 typedef enum {
     VFS_LOOKUP_CREATE_NONE,
@@ -35,6 +37,13 @@ typedef struct vfs_node {
     struct vfs_node_ops *ops;
     vfs_node_type_t type;
     void *data;
+    uint32_t refcount; // Open resources and file mappings, the page cache is dropped once none are left
+    struct {
+        spinlock_t lock;
+        list_t pages;
+        bool sync_queued;
+        work_t sync_work;
+    } page_cache; // Zeroed on node creation, see fs/page_cache.h
 } vfs_node_t;
 
 typedef struct {
@@ -123,6 +132,17 @@ typedef struct vfs_node_ops {
 
 extern list_t g_vfs_all;
 
+/**
+ * @brief Take a reference on a node for an open resource or a file mapping
+ */
+void vfs_node_ref(vfs_node_t *node);
+
+/**
+ * @brief Drop a reference on a node, the page cache of the node is released once the last one is gone
+ * @note Safe to call with spinlocks held, the release runs on a worker
+ */
+void vfs_node_unref(vfs_node_t *node);
+
 /**
  * @brief Mount a VFS on path
  * @param data private VFS data
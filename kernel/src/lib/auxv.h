@@ -19,6 +19,9 @@
 
 #define AUXV_SECURE 23
 
+#define AUXV_HWCAP2 26
+#define AUXV_HWCAP2_FSGSBASE (1 << 1)
+
 typedef struct {
     uint64_t entry;
     uint64_t phdr;
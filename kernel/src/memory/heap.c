@@ -35,6 +35,7 @@ static uint64_t get_prot(heap_entry_t *entry) {
 #endif
 
 void heap_initialize(vmm_address_space_t *address_space, size_t size) {
+    lockstat_register(&g_lock, "heap");
     void *addr = vmm_map_anon(address_space, NULL, size, VMM_PROT_READ | VMM_PROT_WRITE, VMM_FLAG_NONE, VMM_CACHE_STANDARD);
     log(LOG_LEVEL_DEBUG, "HEAP", "Initialized at address %#lx with size %#lx", (uintptr_t) addr, size);
     ASSERT(addr != NULL);
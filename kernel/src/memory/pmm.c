@@ -31,6 +31,7 @@ void pmm_zone_register(int zone_index, char *name, uintptr_t start, uintptr_t en
     zone->start = start;
     zone->end = end;
     zone->lock = SPINLOCK_INIT;
+    lockstat_register(&zone->lock, "pmm");
     zone->regions = LIST_INIT;
     for(int i = 0; i <= PMM_MAX_ORDER; i++) zone->lists[i] = LIST_INIT;
 }
@@ -145,7 +146,7 @@ void pmm_free(pmm_page_t *page) {
     spinlock_release(&zone->lock);
 }
 
-void pmm_free_address(uintptr_t physical_address) {
+pmm_page_t *pmm_page(uintptr_t physical_address) {
     for(size_t i = 0; i <= PMM_ZONE_MAX; i++) {
         pmm_zone_t *zone = &g_pmm_zones[i];
         if(zone->start > physical_address || zone->end <= physical_address) continue;
@@ -153,7 +154,13 @@ void pmm_free_address(uintptr_t physical_address) {
             pmm_region_t *region = LIST_CONTAINER_GET(elem, pmm_region_t, list_elem);
             if(region->base > physical_address || region->base + region->page_count * ARCH_PAGE_SIZE <= physical_address) continue;
 
-            pmm_free(&region->pages[(physical_address - region->base) / ARCH_PAGE_SIZE]);
+            return &region->pages[(physical_address - region->base) / ARCH_PAGE_SIZE];
         }
     }
+    return NULL;
+}
+
+void pmm_free_address(uintptr_t physical_address) {
+    pmm_page_t *page = pmm_page(physical_address);
+    if(page != NULL) pmm_free(page);
 }
\ No newline at end of file
@@ -35,6 +35,7 @@ typedef struct pmm_page {
     list_element_t list_elem;
     struct pmm_region *region;
     uintptr_t paddr;
+    uint32_t refcount; // Number of mappings referencing this page, maintained by the VMM
     uint8_t order : 3;
     uint8_t free : 1;
 } pmm_page_t;
@@ -82,6 +83,13 @@ pmm_page_t *pmm_alloc_page(pmm_flags_t flags);
  */
 void pmm_free(pmm_page_t *page);
 
+/**
+ * @brief Retrieve the page descriptor of a physical address
+ * @warning relatively expensive
+ * @returns page or NULL if the address is not managed by the PMM
+ */
+pmm_page_t *pmm_page(uintptr_t physical_address);
+
 /**
  * @brief Frees a previously allocated page by address
  * @warning relatively expensive
@@ -0,0 +1,297 @@
+#include "vmem.h"
+#include <lib/list.h>
+#include <common/assert.h>
+#include <common/log.h>
+#include <memory/pmm.h>
+#include <memory/hhdm.h>
+#include <arch/types.h>
+
+#define TAG_RESERVE 4 // Upper bound of tags consumed by a single operation
+#define BT(ELEM, MEMBER) (LIST_CONTAINER_GET((ELEM), vmem_bt_t, MEMBER))
+
+static inline size_t log2_floor(size_t value) {
+    return 63 - __builtin_clzl(value);
+}
+
+/** @warning Assumes lock is acquired */
+static void tags_refill(vmem_t *arena) {
+    if(arena->free_tag_count >= TAG_RESERVE) return;
+    vmem_bt_t *tags = (vmem_bt_t *) HHDM(pmm_alloc_page(PMM_STANDARD)->paddr);
+    for(size_t i = 0; i < ARCH_PAGE_SIZE / sizeof(vmem_bt_t); i++) {
+        list_append(&arena->free_tags, &tags[i].list_bucket);
+        arena->free_tag_count++;
+    }
+}
+
+/** @warning Assumes lock is acquired */
+static vmem_bt_t *tag_alloc(vmem_t *arena) {
+    ASSERT(arena->free_tag_count > 0);
+    list_element_t *elem = LIST_NEXT(&arena->free_tags);
+    list_delete(elem);
+    arena->free_tag_count--;
+    return BT(elem, list_bucket);
+}
+
+/** @warning Assumes lock is acquired */
+static void tag_free(vmem_t *arena, vmem_bt_t *bt) {
+    list_append(&arena->free_tags, &bt->list_bucket);
+    arena->free_tag_count++;
+}
+
+static void freelist_insert(vmem_t *arena, vmem_bt_t *bt) {
+    bt->type = VMEM_BT_TYPE_FREE;
+    list_append(&arena->freelists[log2_floor(bt->size / arena->quantum)], &bt->list_bucket);
+}
+
+static void hash_insert(vmem_t *arena, vmem_bt_t *bt) {
+    bt->type = VMEM_BT_TYPE_ALLOCATED;
+    list_append(&arena->hash[(bt->base / arena->quantum) % VMEM_HASH_SIZE], &bt->list_bucket);
+}
+
+static vmem_bt_t *hash_find(vmem_t *arena, uintptr_t base) {
+    LIST_FOREACH(&arena->hash[(base / arena->quantum) % VMEM_HASH_SIZE], elem) {
+        vmem_bt_t *bt = BT(elem, list_bucket);
+        if(bt->base == base) return bt;
+    }
+    return NULL;
+}
+
+static vmem_bt_t *segment_neighbour(vmem_t *arena, list_element_t *elem) {
+    if(elem == NULL || elem == &arena->segments) return NULL;
+    return BT(elem, list_segments);
+}
+
+/**
+ * @brief Allocate a range out of a free segment
+ * @warning Assumes lock is acquired and the free segment covers the range
+ */
+static vmem_bt_t *segment_carve(vmem_t *arena, vmem_bt_t *bt, uintptr_t base, size_t size) {
+    ASSERT(bt->type == VMEM_BT_TYPE_FREE && bt->base <= base && bt->base + bt->size >= base + size);
+    list_delete(&bt->list_bucket);
+    if(bt->base < base) {
+        vmem_bt_t *lower = tag_alloc(arena);
+        lower->base = bt->base;
+        lower->size = base - bt->base;
+        list_prepend(&bt->list_segments, &lower->list_segments);
+        freelist_insert(arena, lower);
+        bt->base = base;
+        bt->size -= lower->size;
+    }
+    if(bt->size > size) {
+        vmem_bt_t *upper = tag_alloc(arena);
+        upper->base = base + size;
+        upper->size = bt->size - size;
+        list_append(&bt->list_segments, &upper->list_segments);
+        freelist_insert(arena, upper);
+        bt->size = size;
+    }
+    hash_insert(arena, bt);
+    return bt;
+}
+
+/**
+ * @brief Isolate a range of an allocated segment into its own segment
+ * @warning Assumes lock is acquired
+ */
+static vmem_bt_t *segment_isolate(vmem_t *arena, uintptr_t address, size_t size) {
+    vmem_bt_t *bt = hash_find(arena, address);
+    if(bt == NULL) {
+        // OPTIMIZE: freeing part of an allocation falls back to a linear search
+        LIST_FOREACH(&arena->segments, elem) {
+            vmem_bt_t *candidate = BT(elem, list_segments);
+            if(candidate->type != VMEM_BT_TYPE_ALLOCATED || candidate->base > address || candidate->base + candidate->size <= address) continue;
+            bt = candidate;
+            break;
+        }
+    }
+    ASSERT_COMMENT(bt != NULL && bt->type == VMEM_BT_TYPE_ALLOCATED && bt->base + bt->size >= address + size, "Freeing a range that is not allocated");
+
+    if(bt->base < address) {
+        vmem_bt_t *upper = tag_alloc(arena);
+        upper->base = address;
+        upper->size = (bt->base + bt->size) - address;
+        bt->size = address - bt->base;
+        list_append(&bt->list_segments, &upper->list_segments);
+        hash_insert(arena, upper);
+        bt = upper;
+    }
+    if(bt->size > size) {
+        vmem_bt_t *upper = tag_alloc(arena);
+        upper->base = address + size;
+        upper->size = bt->size - size;
+        bt->size = size;
+        list_append(&bt->list_segments, &upper->list_segments);
+        hash_insert(arena, upper);
+    }
+    return bt;
+}
+
+/**
+ * @brief Return a range to the free lists, coalescing with free neighbours
+ * @warning Assumes lock is acquired
+ */
+static void segment_release(vmem_t *arena, uintptr_t address, size_t size) {
+    tags_refill(arena);
+    vmem_bt_t *bt = segment_isolate(arena, address, size);
+    list_delete(&bt->list_bucket);
+
+    vmem_bt_t *prev = segment_neighbour(arena, LIST_PREVIOUS(&bt->list_segments));
+    if(prev != NULL && prev->type == VMEM_BT_TYPE_FREE) {
+        list_delete(&prev->list_bucket);
+        list_delete(&prev->list_segments);
+        bt->base = prev->base;
+        bt->size += prev->size;
+        tag_free(arena, prev);
+    }
+
+    vmem_bt_t *next = segment_neighbour(arena, LIST_NEXT(&bt->list_segments));
+    if(next != NULL && next->type == VMEM_BT_TYPE_FREE) {
+        list_delete(&next->list_bucket);
+        list_delete(&next->list_segments);
+        bt->size += next->size;
+        tag_free(arena, next);
+    }
+
+    freelist_insert(arena, bt);
+}
+
+/**
+ * @brief Return every range parked in the quantum caches to the free lists
+ * @warning Assumes lock is acquired
+ * @returns false if the caches were empty
+ */
+static bool qcache_purge(vmem_t *arena) {
+    bool purged = false;
+    for(size_t i = 0; i < arena->qcache_max; i++) {
+        vmem_qcache_t *qcache = &arena->qcaches[i];
+        while(qcache->count > 0) {
+            segment_release(arena, qcache->addresses[--qcache->count], (i + 1) * arena->quantum);
+            purged = true;
+        }
+    }
+    return purged;
+}
+
+void vmem_init(vmem_t *arena, const char *name, size_t quantum, size_t qcache_max) {
+    ASSERT(quantum > 0 && (quantum & (quantum - 1)) == 0);
+    arena->name = name;
+    arena->lock = SPINLOCK_INIT;
+    arena->quantum = quantum;
+    arena->qcache_max = qcache_max > VMEM_QCACHE_MAX ? VMEM_QCACHE_MAX : qcache_max;
+    arena->segments = LIST_INIT_CIRCULAR(arena->segments);
+    for(size_t i = 0; i < VMEM_FREELIST_COUNT; i++) arena->freelists[i] = LIST_INIT;
+    for(size_t i = 0; i < VMEM_HASH_SIZE; i++) arena->hash[i] = LIST_INIT;
+    arena->free_tags = LIST_INIT;
+    arena->free_tag_count = 0;
+    for(size_t i = 0; i < VMEM_QCACHE_MAX; i++) arena->qcaches[i].count = 0;
+}
+
+bool vmem_add(vmem_t *arena, uintptr_t base, size_t size) {
+    if(base == 0 || size == 0 || base % arena->quantum != 0 || size % arena->quantum != 0) return false;
+
+    spinlock_acquire(&arena->lock);
+    tags_refill(arena);
+
+    list_element_t *position = &arena->segments;
+    LIST_FOREACH(&arena->segments, elem) {
+        vmem_bt_t *bt = BT(elem, list_segments);
+        if(bt->base > base) break;
+        position = elem;
+    }
+
+    vmem_bt_t *span = tag_alloc(arena);
+    span->type = VMEM_BT_TYPE_SPAN;
+    span->base = base;
+    span->size = size;
+    list_append(position, &span->list_segments);
+
+    vmem_bt_t *initial = tag_alloc(arena);
+    initial->base = base;
+    initial->size = size;
+    list_append(&span->list_segments, &initial->list_segments);
+    freelist_insert(arena, initial);
+    spinlock_release(&arena->lock);
+
+    log(LOG_LEVEL_DEBUG, "VMEM", "%s: added span (base: %#lx, size: %#lx)", arena->name, base, size);
+    return true;
+}
+
+uintptr_t vmem_alloc(vmem_t *arena, size_t size) {
+    ASSERT(size > 0 && size % arena->quantum == 0);
+    size_t quanta = size / arena->quantum;
+
+    spinlock_acquire(&arena->lock);
+    if(quanta <= arena->qcache_max) {
+        vmem_qcache_t *qcache = &arena->qcaches[quanta - 1];
+        if(qcache->count > 0) {
+            uintptr_t address = qcache->addresses[--qcache->count];
+            spinlock_release(&arena->lock);
+            return address;
+        }
+    }
+
+    tags_refill(arena);
+
+    // Instant fit, every segment on a list above the size class is large enough
+    size_t index = log2_floor(quanta);
+    size_t first = (quanta & (quanta - 1)) == 0 ? index : index + 1;
+    for(size_t i = first; i < VMEM_FREELIST_COUNT; i++) {
+        if(list_is_empty(&arena->freelists[i])) continue;
+        vmem_bt_t *bt = BT(LIST_NEXT(&arena->freelists[i]), list_bucket);
+        uintptr_t address = segment_carve(arena, bt, bt->base, size)->base;
+        spinlock_release(&arena->lock);
+        return address;
+    }
+
+    // Fall back to the size class itself, it may still hold a fitting segment
+    if(first != index) {
+        LIST_FOREACH(&arena->freelists[index], elem) {
+            vmem_bt_t *bt = BT(elem, list_bucket);
+            if(bt->size < size) continue;
+            uintptr_t address = segment_carve(arena, bt, bt->base, size)->base;
+            spinlock_release(&arena->lock);
+            return address;
+        }
+    }
+    spinlock_release(&arena->lock);
+    return 0;
+}
+
+uintptr_t vmem_xalloc(vmem_t *arena, uintptr_t address, size_t size) {
+    ASSERT(size > 0 && size % arena->quantum == 0 && address % arena->quantum == 0);
+
+    spinlock_acquire(&arena->lock);
+    // Cached ranges keep their allocated tags, the requested range might be parked in a quantum cache
+    do {
+        tags_refill(arena);
+        LIST_FOREACH(&arena->segments, elem) {
+            vmem_bt_t *bt = BT(elem, list_segments);
+            if(bt->type != VMEM_BT_TYPE_FREE) continue;
+            if(bt->base > address) break;
+            if(bt->base + bt->size < address + size) continue;
+            segment_carve(arena, bt, address, size);
+            spinlock_release(&arena->lock);
+            return address;
+        }
+    } while(qcache_purge(arena));
+    spinlock_release(&arena->lock);
+    return 0;
+}
+
+void vmem_free(vmem_t *arena, uintptr_t address, size_t size) {
+    ASSERT(size > 0 && size % arena->quantum == 0 && address % arena->quantum == 0);
+    size_t quanta = size / arena->quantum;
+
+    spinlock_acquire(&arena->lock);
+    if(quanta <= arena->qcache_max) {
+        vmem_qcache_t *qcache = &arena->qcaches[quanta - 1];
+        if(qcache->count < VMEM_QCACHE_DEPTH) {
+            qcache->addresses[qcache->count++] = address;
+            spinlock_release(&arena->lock);
+            return;
+        }
+    }
+
+    segment_release(arena, address, size);
+    spinlock_release(&arena->lock);
+}
\ No newline at end of file
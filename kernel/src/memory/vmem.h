@@ -0,0 +1,75 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <lib/list.h>
+#include <common/spinlock.h>
+
+#define VMEM_FREELIST_COUNT 64
+#define VMEM_HASH_SIZE 256
+#define VMEM_QCACHE_MAX 8
+#define VMEM_QCACHE_DEPTH 16
+
+typedef enum {
+    VMEM_BT_TYPE_SPAN,
+    VMEM_BT_TYPE_FREE,
+    VMEM_BT_TYPE_ALLOCATED
+} vmem_bt_type_t;
+
+typedef struct {
+    vmem_bt_type_t type;
+    uintptr_t base;
+    size_t size;
+    list_element_t list_segments;
+    list_element_t list_bucket;
+} vmem_bt_t;
+
+typedef struct {
+    size_t count;
+    uintptr_t addresses[VMEM_QCACHE_DEPTH];
+} vmem_qcache_t;
+
+typedef struct {
+    const char *name;
+    spinlock_t lock;
+    size_t quantum;
+    size_t qcache_max;
+    list_t segments;
+    list_t freelists[VMEM_FREELIST_COUNT];
+    list_t hash[VMEM_HASH_SIZE];
+    list_t free_tags;
+    size_t free_tag_count;
+    vmem_qcache_t qcaches[VMEM_QCACHE_MAX];
+} vmem_t;
+
+/**
+ * @brief Initialize an arena
+ * @param quantum allocation granularity
+ * @param qcache_max largest allocation, in quanta, served by the quantum caches
+ */
+void vmem_init(vmem_t *arena, const char *name, size_t quantum, size_t qcache_max);
+
+/**
+ * @brief Add a span of free space to an arena
+ * @warning The span must not overlap existing spans and must not contain address 0
+ * @returns false on failure
+ */
+bool vmem_add(vmem_t *arena, uintptr_t base, size_t size);
+
+/**
+ * @brief Allocate a quantum aligned range
+ * @param size multiple of the quantum
+ * @returns base address, 0 on failure
+ */
+uintptr_t vmem_alloc(vmem_t *arena, size_t size);
+
+/**
+ * @brief Allocate a specific range
+ * @warning Not accelerated, intended for fixed and boot time reservations
+ * @returns base address, 0 on failure
+ */
+uintptr_t vmem_xalloc(vmem_t *arena, uintptr_t address, size_t size);
+
+/**
+ * @brief Free a range, which may be a part of a previous allocation
+ */
+void vmem_free(vmem_t *arena, uintptr_t address, size_t size);
\ No newline at end of file
@@ -5,9 +5,15 @@
 #include <common/assert.h>
 #include <memory/pmm.h>
 #include <memory/hhdm.h>
+#include <memory/vmem.h>
+#include <fs/page_cache.h>
+#include <sched/preempt.h>
 #include <arch/vmm.h>
 #include <arch/types.h>
 
+#define KERNEL_ARENA_QCACHE_MAX 8
+#define FAULT_LOCK_COUNT 64
+
 #define ADDRESS_IN_BOUNDS(ADDRESS_SPACE, ADDRESS) ((ADDRESS) >= (ADDRESS_SPACE)->start && (ADDRESS) < (ADDRESS_SPACE)->end)
 #define SEGMENT_IN_BOUNDS(ADDRESS_SPACE, BASE, LENGTH) (ADDRESS_IN_BOUNDS((ADDRESS_SPACE), (BASE)) && ((ADDRESS_SPACE)->end - (BASE)) >= (LENGTH))
 
@@ -19,6 +25,11 @@ vmm_address_space_t *g_vmm_kernel_address_space;
 static spinlock_t g_segments_lock = SPINLOCK_INIT;
 static list_t g_segments_free = LIST_INIT;
 
+static vmem_t g_kernel_arena;
+
+// Faults only take the address space lock shared, installing a page is serialized per page through these instead
+static spinlock_t g_fault_locks[FAULT_LOCK_COUNT];
+
 static_assert(ARCH_PAGE_SIZE > (sizeof(vmm_segment_t) * 2));
 
 /** @warning Assumes lock is acquired */
@@ -39,12 +50,29 @@ static uintptr_t find_space(vmm_address_space_t *address_space, uintptr_t addres
     return address;
 }
 
-static void segment_map(vmm_segment_t *segment, uintptr_t address, uintptr_t length) {
-    ASSERT(address % ARCH_PAGE_SIZE == 0 && length % ARCH_PAGE_SIZE == 0);
-    ASSERT(address < segment->base || address + length >= segment->base);
+static void page_release(uintptr_t physical_address) {
+    pmm_page_t *page = pmm_page(physical_address);
+    if(page == NULL) return;
+    if(__atomic_sub_fetch(&page->refcount, 1, __ATOMIC_ACQ_REL) == 0) pmm_free(page);
+}
+
+/** @brief Protection of freshly mapped pages, private file pages are mapped read-only until written to */
+static vmm_protection_t segment_page_protection(vmm_segment_t *segment) {
+    if(segment->type == VMM_SEGMENT_TYPE_FILE && !segment->type_specific_data.file.shared) return segment->protection & ~VMM_PROT_WRITE;
+    return segment->protection;
+}
 
+static void segment_map_page(vmm_segment_t *segment, uintptr_t address, uintptr_t physical_address) {
     int map_flags = ARCH_VMM_FLAG_NONE;
     if(segment->address_space != g_vmm_kernel_address_space) map_flags |= ARCH_VMM_FLAG_USER;
+    arch_vmm_ptm_map(segment->address_space, address, physical_address, segment_page_protection(segment), segment->cache, map_flags);
+}
+
+/** @note File pages are left to vmm_fault, which reads them in without holding the lock */
+static void segment_map(vmm_segment_t *segment, uintptr_t address, uintptr_t length) {
+    ASSERT(address % ARCH_PAGE_SIZE == 0 && length % ARCH_PAGE_SIZE == 0);
+    ASSERT(address < segment->base || address + length >= segment->base);
+    if(segment->type == VMM_SEGMENT_TYPE_FILE) return;
 
     for(size_t i = 0; i < length; i += ARCH_PAGE_SIZE) {
         uintptr_t virtual_address = address + i;
@@ -53,13 +81,16 @@ static void segment_map(vmm_segment_t *segment, uintptr_t address, uintptr_t len
             case VMM_SEGMENT_TYPE_ANON:
                 pmm_flags_t physical_flags = PMM_STANDARD;
                 if(segment->type_specific_data.anon.back_zeroed) physical_flags |= PMM_FLAG_ZERO;
-                physical_address = pmm_alloc_page(physical_flags)->paddr;
+                pmm_page_t *page = pmm_alloc_page(physical_flags);
+                page->refcount = 1;
+                physical_address = page->paddr;
                 break;
             case VMM_SEGMENT_TYPE_DIRECT:
                 physical_address = segment->type_specific_data.direct.physical_address + (virtual_address - segment->base);
                 break;
+            case VMM_SEGMENT_TYPE_FILE: break;
         }
-        arch_vmm_ptm_map(segment->address_space, virtual_address, physical_address, segment->protection, segment->cache, map_flags);
+        segment_map_page(segment, virtual_address, physical_address);
     }
 }
 
@@ -67,22 +98,55 @@ static void segment_unmap(vmm_segment_t *segment, uintptr_t address, uintptr_t l
     ASSERT(address % ARCH_PAGE_SIZE == 0 && length % ARCH_PAGE_SIZE == 0);
     ASSERT(address < segment->base || address + length >= segment->base);
 
-    switch(segment->type) {
-        case VMM_SEGMENT_TYPE_ANON:
-            // OPTIMIZE: invent page cache for segments
-            // TODO: unmap phys mem
-            break;
-        case VMM_SEGMENT_TYPE_DIRECT: break;
+    for(uintptr_t i = 0; i < length; i += ARCH_PAGE_SIZE) {
+        uintptr_t physical_address;
+        bool mapped = arch_vmm_ptm_physical(segment->address_space, address + i, &physical_address);
+        if(!mapped) continue;
+        arch_vmm_ptm_unmap(segment->address_space, address + i);
+        switch(segment->type) {
+            case VMM_SEGMENT_TYPE_ANON:
+            case VMM_SEGMENT_TYPE_FILE: page_release(physical_address); break;
+            case VMM_SEGMENT_TYPE_DIRECT: break;
+        }
+    }
+    if(segment->type == VMM_SEGMENT_TYPE_FILE && segment->type_specific_data.file.shared && (segment->protection & VMM_PROT_WRITE) != 0) {
+        page_cache_sync_deferred(segment->type_specific_data.file.node);
     }
-    for(uintptr_t i = 0; i < length; i += ARCH_PAGE_SIZE) arch_vmm_ptm_unmap(segment->address_space, address + i);
+}
+
+/** @warning Assumes lock is acquired, at least shared along with the fault lock of the page */
+static bool segment_cow(vmm_segment_t *segment, uintptr_t address) {
+    ASSERT(address % ARCH_PAGE_SIZE == 0);
+    if(segment->type == VMM_SEGMENT_TYPE_DIRECT || (segment->protection & VMM_PROT_WRITE) == 0) return false;
+
+    uintptr_t physical_address;
+    if(!arch_vmm_ptm_physical(segment->address_space, address, &physical_address)) return false;
+
+    pmm_page_t *page = pmm_page(physical_address);
+    ASSERT(page != NULL);
+    bool shared = segment->type == VMM_SEGMENT_TYPE_FILE && segment->type_specific_data.file.shared;
+    if(!shared && __atomic_load_n(&page->refcount, __ATOMIC_ACQUIRE) > 1) {
+        pmm_page_t *copy = pmm_alloc_page(PMM_STANDARD);
+        copy->refcount = 1;
+        memcpy((void *) HHDM(copy->paddr), (void *) HHDM(physical_address), ARCH_PAGE_SIZE);
+        page_release(physical_address);
+        physical_address = copy->paddr;
+    }
+
+    int map_flags = ARCH_VMM_FLAG_NONE;
+    if(segment->address_space != g_vmm_kernel_address_space) map_flags |= ARCH_VMM_FLAG_USER;
+    arch_vmm_ptm_map(segment->address_space, address, physical_address, segment->protection, segment->cache, map_flags);
+    return true;
 }
 
 static vmm_segment_t *segments_alloc(bool kernel_as_lock_acquired) {
     spinlock_acquire(&g_segments_lock);
     if(list_is_empty(&g_segments_free)) {
         pmm_page_t *page = pmm_alloc_page(PMM_STANDARD);
-        if(!kernel_as_lock_acquired) spinlock_acquire(&g_vmm_kernel_address_space->lock);
-        uintptr_t address = find_space(g_vmm_kernel_address_space, 0, ARCH_PAGE_SIZE);
+        page->refcount = 1;
+        uintptr_t address = vmem_alloc(&g_kernel_arena, ARCH_PAGE_SIZE);
+        ASSERT(address != 0);
+        if(!kernel_as_lock_acquired) rwlock_write_acquire(&g_vmm_kernel_address_space->lock);
         arch_vmm_ptm_map(g_vmm_kernel_address_space, address, page->paddr, VMM_PROT_READ | VMM_PROT_WRITE, VMM_CACHE_STANDARD, ARCH_VMM_FLAG_NONE);
 
         vmm_segment_t *new_segments = (vmm_segment_t *) address;
@@ -97,7 +161,7 @@ static vmm_segment_t *segments_alloc(bool kernel_as_lock_acquired) {
 
         for(unsigned int i = 1; i < ARCH_PAGE_SIZE / sizeof(vmm_segment_t); i++) list_append(&g_segments_free, &new_segments[i].list_elem);
 
-        if(!kernel_as_lock_acquired) spinlock_release(&g_vmm_kernel_address_space->lock);
+        if(!kernel_as_lock_acquired) rwlock_write_release(&g_vmm_kernel_address_space->lock);
     }
     list_element_t *elem = LIST_NEXT(&g_segments_free);
     ASSERT(elem != NULL);
@@ -122,6 +186,36 @@ static vmm_segment_t *addr_to_segment(vmm_address_space_t *address_space, uintpt
     return NULL;
 }
 
+/**
+ * @brief Split a segment in two at address
+ * @warning Assumes lock is acquired
+ * @returns the upper segment
+ */
+static vmm_segment_t *segment_split(vmm_segment_t *segment, uintptr_t address) {
+    ASSERT(address % ARCH_PAGE_SIZE == 0 && address > segment->base && address < segment->base + segment->length);
+
+    vmm_segment_t *upper = segments_alloc(segment->address_space == g_vmm_kernel_address_space);
+    upper->address_space = segment->address_space;
+    upper->base = address;
+    upper->length = (segment->base + segment->length) - address;
+    upper->protection = segment->protection;
+    upper->cache = segment->cache;
+    upper->type = segment->type;
+    upper->type_specific_data = segment->type_specific_data;
+    switch(upper->type) {
+        case VMM_SEGMENT_TYPE_ANON: break;
+        case VMM_SEGMENT_TYPE_DIRECT: upper->type_specific_data.direct.physical_address += address - segment->base; break;
+        case VMM_SEGMENT_TYPE_FILE:
+            upper->type_specific_data.file.offset += address - segment->base;
+            vfs_node_ref(upper->type_specific_data.file.node);
+            break;
+    }
+    segment->length = address - segment->base;
+
+    list_append(&segment->list_elem, &upper->list_elem);
+    return upper;
+}
+
 // OPTIMIZE: this is very slow/inefficient, segments should probably be ordered or in a tree and we could do this fast
 static bool memory_exists(vmm_address_space_t *address_space, uintptr_t address, size_t length) {
     if(!ADDRESS_IN_BOUNDS(address_space, address) || !ADDRESS_IN_BOUNDS(address_space, address + length)) return false;
@@ -144,6 +238,35 @@ static bool memory_exists(vmm_address_space_t *address_space, uintptr_t address,
     return false;
 }
 
+/** @warning Assumes lock is acquired */
+static void unmap(vmm_address_space_t *address_space, uintptr_t address, size_t length) {
+    for(uintptr_t split_base = address, split_length = 0; split_base < address + length; split_base += split_length) {
+        split_length = ARCH_PAGE_SIZE;
+        vmm_segment_t *split_segment = addr_to_segment(address_space, split_base);
+        if(!split_segment) continue;
+
+        while(
+            ADDRESS_IN_SEGMENT(split_base + split_length, split_segment->base, split_segment->length) &&
+            ADDRESS_IN_SEGMENT(split_base + split_length, address, length)
+        ) split_length += ARCH_PAGE_SIZE;
+
+        ASSERT(SEGMENT_IN_BOUNDS(address_space, split_base, split_length));
+        ASSERT(split_base % ARCH_PAGE_SIZE == 0 && split_length % ARCH_PAGE_SIZE == 0);
+
+        segment_unmap(split_segment, split_base, split_length);
+        if(address_space == g_vmm_kernel_address_space) vmem_free(&g_kernel_arena, split_base, split_length);
+        if(split_segment->base + split_segment->length > split_base + split_length) segment_split(split_segment, split_base + split_length);
+
+        if(split_segment->base < split_base) {
+            split_segment->length = split_base - split_segment->base;
+        } else {
+            list_delete(&split_segment->list_elem);
+            if(split_segment->type == VMM_SEGMENT_TYPE_FILE) vfs_node_unref(split_segment->type_specific_data.file.node);
+            segments_free(split_segment, address_space == g_vmm_kernel_address_space);
+        }
+    }
+}
+
 static void *map_common(
     vmm_address_space_t *address_space,
     void *hint,
@@ -152,7 +275,7 @@ static void *map_common(
     vmm_cache_t cache,
     vmm_flags_t flags,
     vmm_segment_type_t type,
-    uintptr_t direct_physical_address
+    vmm_segment_type_specific_data_t type_specific_data
 ) {
     log(LOG_LEVEL_DEBUG, "VMM", "map(hint: %#lx, length: %#lx, prot: %c%c%c, flags: %lu, cache: %u, type: %u)",
         (uintptr_t) hint,
@@ -173,11 +296,16 @@ static void *map_common(
     }
 
     vmm_segment_t *segment = segments_alloc(false);
-    spinlock_acquire(&address_space->lock);
-    address = find_space(address_space, address, length);
+    rwlock_write_acquire(&address_space->lock);
+    if((flags & (VMM_FLAG_FIXED | VMM_FLAG_REPLACE)) == (VMM_FLAG_FIXED | VMM_FLAG_REPLACE) && SEGMENT_IN_BOUNDS(address_space, address, length)) unmap(address_space, address, length);
+    if(address_space == g_vmm_kernel_address_space) {
+        address = (flags & VMM_FLAG_FIXED) != 0 ? vmem_xalloc(&g_kernel_arena, address, length) : vmem_alloc(&g_kernel_arena, length);
+    } else {
+        address = find_space(address_space, address, length);
+    }
     if(address == 0 || ((uintptr_t) hint != address && (flags & VMM_FLAG_FIXED) != 0)) {
         segments_free(segment, false);
-        spinlock_release(&address_space->lock);
+        rwlock_write_release(&address_space->lock);
         return NULL;
     }
 
@@ -190,27 +318,45 @@ static void *map_common(
     segment->type = type;
     segment->protection = prot;
     segment->cache = cache;
-
-    switch(segment->type) {
-        case VMM_SEGMENT_TYPE_ANON: segment->type_specific_data.anon.back_zeroed = (flags & VMM_FLAG_ANON_ZERO) != 0; break;
-        case VMM_SEGMENT_TYPE_DIRECT: segment->type_specific_data.direct.physical_address = direct_physical_address; break;
-    }
+    segment->type_specific_data = type_specific_data;
 
     if((flags & VMM_FLAG_NO_DEMAND) != 0) segment_map(segment, segment->base, segment->length);
 
     list_append(&address_space->segments, &segment->list_elem);
-    spinlock_release(&address_space->lock);
+    rwlock_write_release(&address_space->lock);
 
     log(LOG_LEVEL_DEBUG, "VMM", "map success (base: %#lx, length: %#lx)", segment->base, segment->length);
     return (void *) segment->base;
 }
 
+void vmm_kernel_arena_init() {
+    lockstat_register(&g_segments_lock, "vmm_segments");
+    vmem_init(&g_kernel_arena, "kernel", ARCH_PAGE_SIZE, KERNEL_ARENA_QCACHE_MAX);
+    ASSERT(vmem_add(&g_kernel_arena, g_vmm_kernel_address_space->start, g_vmm_kernel_address_space->end - g_vmm_kernel_address_space->start));
+
+    rwlock_read_acquire(&g_vmm_kernel_address_space->lock);
+    LIST_FOREACH(&g_vmm_kernel_address_space->segments, elem) {
+        vmm_segment_t *segment = LIST_CONTAINER_GET(elem, vmm_segment_t, list_elem);
+        ASSERT(vmem_xalloc(&g_kernel_arena, segment->base, segment->length) != 0);
+    }
+    rwlock_read_release(&g_vmm_kernel_address_space->lock);
+}
+
 void *vmm_map_anon(vmm_address_space_t *address_space, void *hint, size_t length, vmm_protection_t prot, vmm_cache_t cache, vmm_flags_t flags) {
-    return map_common(address_space, hint, length, prot, cache, flags, VMM_SEGMENT_TYPE_ANON, 0);
+    return map_common(address_space, hint, length, prot, cache, flags, VMM_SEGMENT_TYPE_ANON, (vmm_segment_type_specific_data_t) { .anon = { .back_zeroed = (flags & VMM_FLAG_ANON_ZERO) != 0 } });
 }
 
 void *vmm_map_direct(vmm_address_space_t *address_space, void *hint, size_t length, vmm_protection_t prot, vmm_cache_t cache, vmm_flags_t flags, uintptr_t physical_address) {
-    return map_common(address_space, hint, length, prot, cache, flags, VMM_SEGMENT_TYPE_DIRECT, physical_address);
+    return map_common(address_space, hint, length, prot, cache, flags, VMM_SEGMENT_TYPE_DIRECT, (vmm_segment_type_specific_data_t) { .direct = { .physical_address = physical_address } });
+}
+
+void *vmm_map_file(vmm_address_space_t *address_space, void *hint, size_t length, vmm_protection_t prot, vmm_flags_t flags, struct vfs_node *node, size_t offset) {
+    if(offset % ARCH_PAGE_SIZE != 0) return NULL;
+    // Taken up front, the segment can be unmapped by another thread as soon as it is published
+    vfs_node_ref(node);
+    void *address = map_common(address_space, hint, length, prot, VMM_CACHE_STANDARD, flags, VMM_SEGMENT_TYPE_FILE, (vmm_segment_type_specific_data_t) { .file = { .node = node, .offset = offset, .shared = (flags & VMM_FLAG_SHARED) != 0 } });
+    if(address == NULL) vfs_node_unref(node);
+    return address;
 }
 
 void vmm_unmap(vmm_address_space_t *address_space, void *address, size_t length) {
@@ -219,63 +365,194 @@ void vmm_unmap(vmm_address_space_t *address_space, void *address, size_t length)
     ASSERT((uintptr_t) address % ARCH_PAGE_SIZE == 0 && length % ARCH_PAGE_SIZE == 0);
     ASSERT(SEGMENT_IN_BOUNDS(address_space, (uintptr_t) address, length));
 
-    spinlock_acquire(&address_space->lock);
-    for(uintptr_t split_base = (uintptr_t) address, split_length = 0; split_base < (uintptr_t) address + length; split_base += split_length) {
-        split_length = ARCH_PAGE_SIZE;
-        vmm_segment_t *split_segment = addr_to_segment(address_space, split_base);
-        if(!split_segment) continue;
+    rwlock_write_acquire(&address_space->lock);
+    unmap(address_space, (uintptr_t) address, length);
+    rwlock_write_release(&address_space->lock);
+}
 
-        while(
-            ADDRESS_IN_SEGMENT(split_base + split_length, split_segment->base, split_segment->length) &&
-            ADDRESS_IN_SEGMENT(split_base + split_length, (uintptr_t) address, length)
-        ) split_length += ARCH_PAGE_SIZE;
+bool vmm_protect(vmm_address_space_t *address_space, void *address, size_t length, vmm_protection_t prot) {
+    log(LOG_LEVEL_DEBUG, "VMM", "protect(address: %#lx, length: %#lx, prot: %c%c%c)",
+        (uintptr_t) address,
+        length,
+        prot & VMM_PROT_READ ? 'R' : '-',
+        prot & VMM_PROT_WRITE ? 'W' : '-',
+        prot & VMM_PROT_EXEC ? 'E' : '-'
+    );
+    if(length == 0) return true;
+    ASSERT((uintptr_t) address % ARCH_PAGE_SIZE == 0 && length % ARCH_PAGE_SIZE == 0);
+    ASSERT(SEGMENT_IN_BOUNDS(address_space, (uintptr_t) address, length));
 
-        ASSERT(SEGMENT_IN_BOUNDS(address_space, split_base, split_length));
-        ASSERT(split_base % ARCH_PAGE_SIZE == 0 && split_length % ARCH_PAGE_SIZE == 0);
+    int map_flags = ARCH_VMM_FLAG_NONE;
+    if(address_space != g_vmm_kernel_address_space) map_flags |= ARCH_VMM_FLAG_USER;
 
-        segment_unmap(split_segment, split_base, split_length);
-        if(split_segment->base + split_segment->length > split_base + split_length) {
-            vmm_segment_t *segment = segments_alloc(address_space == g_vmm_kernel_address_space);
-            segment->address_space = address_space;
-            segment->base = split_base + split_length;
-            segment->length = (split_segment->base + split_segment->length) - (split_base + split_length);
-            segment->protection = split_segment->protection;
-            segment->type = split_segment->type;
-            switch(segment->type) {
-                case VMM_SEGMENT_TYPE_ANON: break;
-                case VMM_SEGMENT_TYPE_DIRECT: segment->type_specific_data = split_segment->type_specific_data; break;
-            }
+    rwlock_write_acquire(&address_space->lock);
+    if(!memory_exists(address_space, (uintptr_t) address, length)) {
+        rwlock_write_release(&address_space->lock);
+        return false;
+    }
 
-            list_append(&split_segment->list_elem, &segment->list_elem);
-        }
+    uintptr_t end = (uintptr_t) address + length;
+    for(uintptr_t current = (uintptr_t) address; current < end;) {
+        vmm_segment_t *segment = addr_to_segment(address_space, current);
+        ASSERT(segment != NULL);
+        if(segment->base < current) segment = segment_split(segment, current);
+        if(segment->base + segment->length > end) segment_split(segment, end);
 
-        if(split_segment->base < split_base) {
-            split_segment->length = split_base - split_segment->base;
-        } else {
-            list_delete(&split_segment->list_elem);
-            segments_free(split_segment, address_space == g_vmm_kernel_address_space);
+        segment->protection = prot;
+
+        // Pages of private segments may be shared copy-on-write, write access is granted again on fault
+        vmm_protection_t page_prot = prot;
+        if(segment->type != VMM_SEGMENT_TYPE_DIRECT && !(segment->type == VMM_SEGMENT_TYPE_FILE && segment->type_specific_data.file.shared)) page_prot &= ~VMM_PROT_WRITE;
+        if(page_prot == VMM_PROT_WRITE || page_prot == VMM_PROT_EXEC || page_prot == (VMM_PROT_WRITE | VMM_PROT_EXEC)) page_prot |= VMM_PROT_READ;
+
+        arch_vmm_ptm_protect(address_space, segment->base, segment->length, page_prot, segment->cache, map_flags);
+        current = segment->base + segment->length;
+    }
+    arch_vmm_tlb_shootdown(address_space);
+    rwlock_write_release(&address_space->lock);
+    return true;
+}
+
+vmm_address_space_t *vmm_fork(vmm_address_space_t *address_space) {
+    ASSERT(address_space != g_vmm_kernel_address_space);
+    vmm_address_space_t *new_address_space = arch_vmm_address_space_create();
+
+    bool write_protected = false;
+    rwlock_write_acquire(&address_space->lock);
+    LIST_FOREACH(&address_space->segments, elem) {
+        vmm_segment_t *segment = LIST_CONTAINER_GET(elem, vmm_segment_t, list_elem);
+
+        vmm_segment_t *new_segment = segments_alloc(false);
+        new_segment->address_space = new_address_space;
+        new_segment->base = segment->base;
+        new_segment->length = segment->length;
+        new_segment->type = segment->type;
+        new_segment->protection = segment->protection;
+        new_segment->cache = segment->cache;
+        new_segment->type_specific_data = segment->type_specific_data;
+        if(new_segment->type == VMM_SEGMENT_TYPE_FILE) vfs_node_ref(new_segment->type_specific_data.file.node);
+        list_append(&new_address_space->segments, &new_segment->list_elem);
+
+        // Direct segments are demand mapped in the new address space, private pages are shared read-only until written to
+        if(segment->type == VMM_SEGMENT_TYPE_DIRECT) continue;
+
+        vmm_protection_t shared_prot = segment->protection & ~VMM_PROT_WRITE;
+        if(segment->type == VMM_SEGMENT_TYPE_FILE && segment->type_specific_data.file.shared) shared_prot = segment->protection;
+        for(uintptr_t address = segment->base; address < segment->base + segment->length; address += ARCH_PAGE_SIZE) {
+            uintptr_t physical_address;
+            if(!arch_vmm_ptm_physical(address_space, address, &physical_address)) continue;
+
+            pmm_page_t *page = pmm_page(physical_address);
+            ASSERT(page != NULL);
+            __atomic_add_fetch(&page->refcount, 1, __ATOMIC_ACQ_REL);
+            arch_vmm_ptm_map(new_address_space, address, physical_address, shared_prot, segment->cache, ARCH_VMM_FLAG_USER);
+        }
+        if(shared_prot != segment->protection) {
+            arch_vmm_ptm_protect(address_space, segment->base, segment->length, shared_prot, segment->cache, ARCH_VMM_FLAG_USER);
+            write_protected = true;
         }
     }
-    spinlock_release(&address_space->lock);
+    if(write_protected) arch_vmm_tlb_shootdown(address_space);
+    rwlock_write_release(&address_space->lock);
+
+    log(LOG_LEVEL_DEBUG, "VMM", "fork success");
+    return new_address_space;
 }
 
-bool vmm_fault(vmm_address_space_t *address_space, uintptr_t address, int flags) {
-    if((flags & VMM_FAULT_NONPRESENT) == 0) return false;
+void vmm_address_space_destroy(vmm_address_space_t *address_space) {
+    ASSERT(address_space != g_vmm_kernel_address_space);
 
-    vmm_segment_t *segment = NULL;
-    if(ADDRESS_IN_BOUNDS(g_vmm_kernel_address_space, address)) {
-        segment = addr_to_segment(g_vmm_kernel_address_space, address);
-    } else {
-        segment = addr_to_segment(address_space, address);
+    // Nothing runs in the address space anymore, entries are left in place for the arch to free the tables as a whole without shootdowns
+    rwlock_write_acquire(&address_space->lock);
+    for(list_element_t *elem = address_space->segments.next, *next; elem != NULL && elem != &address_space->segments; elem = next) {
+        next = LIST_NEXT(elem);
+        vmm_segment_t *segment = LIST_CONTAINER_GET(elem, vmm_segment_t, list_elem);
+        if(segment->type != VMM_SEGMENT_TYPE_DIRECT) {
+            for(uintptr_t address = segment->base; address < segment->base + segment->length; address += ARCH_PAGE_SIZE) {
+                uintptr_t physical_address;
+                if(arch_vmm_ptm_physical(address_space, address, &physical_address)) page_release(physical_address);
+            }
+        }
+        if(segment->type == VMM_SEGMENT_TYPE_FILE) {
+            if(segment->type_specific_data.file.shared && (segment->protection & VMM_PROT_WRITE) != 0) page_cache_sync_deferred(segment->type_specific_data.file.node);
+            vfs_node_unref(segment->type_specific_data.file.node);
+        }
+        list_delete(elem);
+        segments_free(segment, false);
     }
-    if(segment == NULL) return false;
+    rwlock_write_release(&address_space->lock);
 
-    segment_map(segment, MATH_FLOOR(address, ARCH_PAGE_SIZE), ARCH_PAGE_SIZE);
-    return true;
+    log(LOG_LEVEL_DEBUG, "VMM", "destroy address space");
+    arch_vmm_address_space_destroy(address_space);
+}
+
+static spinlock_t *fault_lock(vmm_address_space_t *address_space, uintptr_t page_address) {
+    uint64_t hash = ((uintptr_t) address_space ^ (page_address / ARCH_PAGE_SIZE)) * 0x9E37'79B9'7F4A'7C15;
+    return &g_fault_locks[hash >> 58];
+}
+
+bool vmm_fault(vmm_address_space_t *address_space, uintptr_t address, int flags) {
+    if(ADDRESS_IN_BOUNDS(g_vmm_kernel_address_space, address)) address_space = g_vmm_kernel_address_space;
+    uintptr_t page_address = MATH_FLOOR(address, ARCH_PAGE_SIZE);
+    bool can_block = preempt_can_block();
+
+    // File systems may block, so file pages are read in with the lock dropped and the fault is retried with the page in hand
+    struct {
+        struct vfs_node *node; // NULL when no page is held
+        size_t offset;
+        uintptr_t physical_address;
+    } file_page = { .node = NULL };
+
+    bool handled;
+    retry:
+    handled = false;
+    rwlock_read_acquire(&address_space->lock);
+    vmm_segment_t *segment = addr_to_segment(address_space, address);
+    if(segment != NULL && segment->protection != VMM_PROT_NONE) {
+        spinlock_t *page_lock = fault_lock(address_space, page_address);
+        spinlock_acquire(page_lock);
+        if((flags & VMM_FAULT_NONPRESENT) != 0) {
+            uintptr_t physical_address;
+            if(!arch_vmm_ptm_physical(address_space, page_address, &physical_address)) {
+                if(segment->type == VMM_SEGMENT_TYPE_FILE) {
+                    struct vfs_node *node = segment->type_specific_data.file.node;
+                    size_t offset = segment->type_specific_data.file.offset + (page_address - segment->base);
+                    // The mapping might have changed while the lock was dropped
+                    if(file_page.node != node || file_page.offset != offset) {
+                        spinlock_release(page_lock);
+                        rwlock_read_release(&address_space->lock);
+                        if(file_page.node != NULL) page_release(file_page.physical_address);
+                        // Callers that cannot block fail instead, user memory accessed under a spinlock has to be faulted in beforehand
+                        if(!can_block) return false;
+                        // A page that cannot be read fails the fault rather than showing up as zeroes
+                        if(page_cache_get(node, offset, &file_page.physical_address) != 0) return false;
+                        file_page.node = node;
+                        file_page.offset = offset;
+                        goto retry;
+                    }
+                    segment_map_page(segment, page_address, file_page.physical_address);
+                    file_page.node = NULL;
+                } else {
+                    segment_map(segment, page_address, ARCH_PAGE_SIZE);
+                }
+            }
+            if((flags & VMM_FAULT_WRITE) != 0 && segment_page_protection(segment) != segment->protection) segment_cow(segment, page_address);
+            handled = true;
+        } else if((flags & VMM_FAULT_WRITE) != 0) {
+            handled = segment_cow(segment, page_address);
+        }
+        spinlock_release(page_lock);
+    }
+    rwlock_read_release(&address_space->lock);
+    if(file_page.node != NULL) page_release(file_page.physical_address);
+    return handled;
 }
 
 size_t vmm_copy_to(vmm_address_space_t *dest_as, uintptr_t dest_addr, void *src, size_t count) {
-    if(!memory_exists(dest_as, dest_addr, count)) return 0;
+    rwlock_read_acquire(&dest_as->lock);
+    bool exists = memory_exists(dest_as, dest_addr, count);
+    rwlock_read_release(&dest_as->lock);
+    if(!exists) return 0;
     size_t i = 0;
     while(i < count) {
         size_t offset = (dest_addr + i) % ARCH_PAGE_SIZE;
@@ -285,6 +562,12 @@ size_t vmm_copy_to(vmm_address_space_t *dest_as, uintptr_t dest_addr, void *src,
             ASSERT(arch_vmm_ptm_physical(dest_as, dest_addr + i, &phys));
         }
 
+        pmm_page_t *page = pmm_page(phys);
+        if(page != NULL && __atomic_load_n(&page->refcount, __ATOMIC_ACQUIRE) > 1) {
+            if(!vmm_fault(dest_as, dest_addr + i, VMM_FAULT_WRITE)) return i;
+            ASSERT(arch_vmm_ptm_physical(dest_as, dest_addr + i, &phys));
+        }
+
         size_t len = math_min(count - i, ARCH_PAGE_SIZE - offset);
         memcpy((void *) HHDM(phys + offset), src, len);
         i += len;
@@ -294,7 +577,10 @@ size_t vmm_copy_to(vmm_address_space_t *dest_as, uintptr_t dest_addr, void *src,
 }
 
 size_t vmm_copy_from(void *dest, vmm_address_space_t *src_as, uintptr_t src_addr, size_t count) {
-    if(!memory_exists(src_as, src_addr, count)) return 0;
+    rwlock_read_acquire(&src_as->lock);
+    bool exists = memory_exists(src_as, src_addr, count);
+    rwlock_read_release(&src_as->lock);
+    if(!exists) return 0;
     size_t i = 0;
     while(i < count) {
         size_t offset = (src_addr + i) % ARCH_PAGE_SIZE;
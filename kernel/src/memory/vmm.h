@@ -2,7 +2,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <lib/list.h>
-#include <common/spinlock.h>
+#include <common/rwlock.h>
 
 #define VMM_PROT_NONE 0
 #define VMM_PROT_READ (1 << 1)
@@ -12,10 +12,13 @@
 #define VMM_FLAG_NONE 0
 #define VMM_FLAG_FIXED (1 << 1)
 #define VMM_FLAG_NO_DEMAND (1 << 2)
+#define VMM_FLAG_SHARED (1 << 3)
+#define VMM_FLAG_REPLACE (1 << 4) /* With VMM_FLAG_FIXED, existing mappings in the range are unmapped under the same lock hold */
 
 #define VMM_FLAG_ANON_ZERO (1 << 10)
 
 #define VMM_FAULT_NONPRESENT (1 << 0)
+#define VMM_FAULT_WRITE (1 << 1)
 
 typedef uint64_t vmm_flags_t;
 typedef uint8_t vmm_protection_t;
@@ -27,11 +30,12 @@ typedef enum {
 
 typedef enum {
     VMM_SEGMENT_TYPE_ANON,
-    VMM_SEGMENT_TYPE_DIRECT
+    VMM_SEGMENT_TYPE_DIRECT,
+    VMM_SEGMENT_TYPE_FILE
 } vmm_segment_type_t;
 
 typedef struct {
-    spinlock_t lock;
+    rwlock_t lock; // Segment list, lookups and faults only take it shared
     list_t segments;
     uintptr_t start, end;
 } vmm_address_space_t;
@@ -39,6 +43,7 @@ typedef struct {
 typedef union {
     struct { bool back_zeroed; } anon;
     struct { uintptr_t physical_address; } direct;
+    struct { struct vfs_node *node; size_t offset; bool shared; } file;
 } vmm_segment_type_specific_data_t;
 
 typedef struct vmm_segment {
@@ -53,6 +58,11 @@ typedef struct vmm_segment {
 
 extern vmm_address_space_t *g_vmm_kernel_address_space;
 
+/**
+ * @brief Initialize the kernel virtual address arena, reserving the segments already present in the kernel address space
+ */
+void vmm_kernel_arena_init();
+
 /**
  * @brief Map a region of anonymous memory
  * @param address_space
@@ -74,6 +84,18 @@ void *vmm_map_anon(vmm_address_space_t *address_space, void *hint, size_t length
  */
 void *vmm_map_direct(vmm_address_space_t *address_space, void *hint, size_t length, vmm_protection_t prot, vmm_cache_t cache, vmm_flags_t flags, uintptr_t physical_address);
 
+/**
+ * @brief Map a region of a file, pages are shared with the file page cache
+ * @param address_space
+ * @param hint page aligned address
+ * @param length page aligned length
+ * @param prot protection
+ * @param flags VMM_FLAG_SHARED to write through to the file, otherwise writes are private copy-on-write
+ * @param node file node
+ * @param offset page aligned offset into the file
+ */
+void *vmm_map_file(vmm_address_space_t *address_space, void *hint, size_t length, vmm_protection_t prot, vmm_flags_t flags, struct vfs_node *node, size_t offset);
+
 /**
  * @brief Unmap a region of memory
  * @param address_space
@@ -82,12 +104,37 @@ void *vmm_map_direct(vmm_address_space_t *address_space, void *hint, size_t leng
  */
 void vmm_unmap(vmm_address_space_t *address_space, void *address, size_t length);
 
+/**
+ * @brief Change the protection of a region of memory, splitting segments as needed
+ * @param address_space
+ * @param address page aligned address
+ * @param length page aligned length
+ * @param prot new protection
+ * @returns false if part of the region is not mapped
+ */
+bool vmm_protect(vmm_address_space_t *address_space, void *address, size_t length, vmm_protection_t prot);
+
+/**
+ * @brief Clone an address space, anonymous memory is shared copy-on-write
+ * @param address_space userspace address space to clone
+ * @returns new address space
+ */
+vmm_address_space_t *vmm_fork(vmm_address_space_t *address_space);
+
+/**
+ * @brief Destroy a userspace address space, releasing its pages, page tables and the address space itself
+ * @warning No thread may run in or access the address space anymore
+ */
+void vmm_address_space_destroy(vmm_address_space_t *address_space);
+
 /**
  * @brief Handle a virtual memory fault
  * @param address_space
  * @param address
  * @param flags fault flags
  * @returns fault handled
+ * @note Faults on file mappings read the page in through the file system without holding the address space lock, which may block.
+ *       A page that cannot be read leaves the fault unhandled
  */
 bool vmm_fault(vmm_address_space_t *address_space, uintptr_t address, int flags);
 
@@ -0,0 +1,195 @@
+#include "futex.h"
+#include <errno.h>
+#include <lib/list.h>
+#include <common/spinlock.h>
+#include <sched/sched.h>
+#include <sched/thread.h>
+#include <arch/sched.h>
+#include <arch/uaccess.h>
+
+#define BUCKET_COUNT 64
+
+typedef struct {
+    spinlock_t lock;
+    list_t waiters;
+} futex_bucket_t;
+
+typedef struct {
+    thread_t *thread;
+    vmm_address_space_t *address_space;
+    uintptr_t address;
+    futex_bucket_t *bucket;
+    bool queued;
+    bool timed_out;
+    timer_t timer;
+    list_element_t list_elem;
+} futex_waiter_t;
+
+// Timeouts take bucket locks from the timer interrupt, everything else holds them at IPL critical
+static futex_bucket_t g_buckets[BUCKET_COUNT];
+
+static futex_bucket_t *bucket_get(vmm_address_space_t *address_space, uintptr_t address) {
+    uint64_t hash = ((uintptr_t) address_space ^ (address >> 2)) * 0x9E37'79B9'7F4A'7C15;
+    return &g_buckets[hash >> 58];
+}
+
+/** @brief Lock the bucket a waiter is queued on, requeueing can move it concurrently */
+static futex_bucket_t *waiter_lock_bucket(futex_waiter_t *waiter) {
+    while(true) {
+        futex_bucket_t *bucket = __atomic_load_n(&waiter->bucket, __ATOMIC_ACQUIRE);
+        spinlock_acquire(&bucket->lock);
+        if(bucket == waiter->bucket) return bucket;
+        spinlock_release(&bucket->lock);
+    }
+}
+
+/** @warning Assumes bucket lock is acquired */
+static void waiter_wake(futex_waiter_t *waiter, bool timed_out) {
+    list_delete(&waiter->list_elem);
+    waiter->queued = false;
+    waiter->timed_out = timed_out;
+    sched_thread_wake(waiter->thread);
+}
+
+/*
+    Runs with the timer lock held, so futex_wait arms the timer before taking the bucket lock.
+    A timeout that fires before the waiter is queued is recorded and picked up by futex_wait.
+*/
+static void timeout(timer_t *timer) {
+    futex_waiter_t *waiter = LIST_CONTAINER_GET(timer, futex_waiter_t, timer);
+    futex_bucket_t *bucket = waiter_lock_bucket(waiter);
+    if(waiter->queued) {
+        waiter_wake(waiter, true);
+    } else {
+        waiter->timed_out = true;
+    }
+    spinlock_release(&bucket->lock);
+}
+
+/** @brief Fault in the futex word, faults on file mappings can block and the value is read under a bucket lock */
+static bool value_fault_in(int *address) {
+    int value;
+    return arch_uaccess_copy_from(&value, address, sizeof(int)) == sizeof(int);
+}
+
+static bool value_matches(int *address, int expected, bool *fault) {
+    int value;
+    *fault = arch_uaccess_copy_from(&value, address, sizeof(int)) != sizeof(int);
+    return !*fault && value == expected;
+}
+
+int futex_wait(vmm_address_space_t *address_space, int *address, int expected, time_t *timeout_length) {
+    futex_waiter_t waiter = {
+        .thread = arch_sched_thread_current(),
+        .address_space = address_space,
+        .address = (uintptr_t) address,
+        .bucket = bucket_get(address_space, (uintptr_t) address),
+        .queued = false,
+        .timed_out = false
+    };
+    if(!value_fault_in(address)) return -EFAULT;
+
+    if(timeout_length != NULL) timer_arm(&waiter.timer, *timeout_length, timeout);
+
+    int r = 0;
+    ipl_t old_ipl = spinlock_acquire_irqsave(&waiter.bucket->lock);
+    bool fault;
+    if(!value_matches(address, expected, &fault)) {
+        r = fault ? -EFAULT : -EAGAIN;
+    } else if(waiter.timed_out) {
+        r = -ETIMEDOUT;
+    }
+    if(r != 0) {
+        spinlock_release_irqrestore(&waiter.bucket->lock, old_ipl);
+        if(timeout_length != NULL) timer_disarm(&waiter.timer);
+        return r;
+    }
+    list_append(&waiter.bucket->waiters, &waiter.list_elem);
+    waiter.queued = true;
+    __atomic_store_n(&waiter.thread->state, THREAD_STATE_BLOCKING, __ATOMIC_SEQ_CST);
+    if(sched_thread_interrupted()) {
+        thread_state_t state = THREAD_STATE_BLOCKING;
+        __atomic_compare_exchange_n(&waiter.thread->state, &state, THREAD_STATE_ACTIVE, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+    spinlock_release_irqrestore(&waiter.bucket->lock, old_ipl);
+
+    arch_sched_yield();
+
+    // The waker holds the bucket lock while touching the waiter, taking it keeps the waiter alive until it is done
+    if(timeout_length != NULL) timer_disarm(&waiter.timer);
+    old_ipl = ipl(IPL_CRITICAL);
+    futex_bucket_t *bucket = waiter_lock_bucket(&waiter);
+    // Still queued when woken by the process exiting
+    if(waiter.queued) {
+        list_delete(&waiter.list_elem);
+        waiter.queued = false;
+        r = -EINTR;
+    }
+    spinlock_release_irqrestore(&bucket->lock, old_ipl);
+    if(r != 0) return r;
+    return waiter.timed_out ? -ETIMEDOUT : 0;
+}
+
+size_t futex_wake(vmm_address_space_t *address_space, int *address, size_t count) {
+    futex_bucket_t *bucket = bucket_get(address_space, (uintptr_t) address);
+    size_t woken = 0;
+    ipl_t old_ipl = spinlock_acquire_irqsave(&bucket->lock);
+    LIST_FOREACH(&bucket->waiters, elem) {
+        if(woken >= count) break;
+        futex_waiter_t *waiter = LIST_CONTAINER_GET(elem, futex_waiter_t, list_elem);
+        if(waiter->address_space != address_space || waiter->address != (uintptr_t) address) continue;
+        waiter_wake(waiter, false);
+        woken++;
+    }
+    spinlock_release_irqrestore(&bucket->lock, old_ipl);
+    return woken;
+}
+
+long futex_requeue(vmm_address_space_t *address_space, int *address, int expected, size_t wake_count, int *target, size_t requeue_count) {
+    futex_bucket_t *bucket = bucket_get(address_space, (uintptr_t) address);
+    futex_bucket_t *target_bucket = bucket_get(address_space, (uintptr_t) target);
+    if(!value_fault_in(address)) return -EFAULT;
+
+    // Lock ordering by bucket address
+    ipl_t old_ipl = ipl(IPL_CRITICAL);
+    if(bucket <= target_bucket) {
+        spinlock_acquire(&bucket->lock);
+        if(target_bucket != bucket) spinlock_acquire(&target_bucket->lock);
+    } else {
+        spinlock_acquire(&target_bucket->lock);
+        spinlock_acquire(&bucket->lock);
+    }
+
+    long count = 0;
+    bool fault;
+    if(!value_matches(address, expected, &fault)) {
+        count = fault ? -EFAULT : -EAGAIN;
+        goto unlock;
+    }
+
+    size_t woken = 0, requeued = 0;
+    // Requeueing relinks waiters, so the next element is fetched up front
+    for(list_element_t *elem = bucket->waiters.next, *next; elem != NULL && elem != &bucket->waiters; elem = next) {
+        next = LIST_NEXT(elem);
+        futex_waiter_t *waiter = LIST_CONTAINER_GET(elem, futex_waiter_t, list_elem);
+        if(waiter->address_space != address_space || waiter->address != (uintptr_t) address) continue;
+        if(woken < wake_count) {
+            waiter_wake(waiter, false);
+            woken++;
+            continue;
+        }
+        if(requeued >= requeue_count) break;
+        list_delete(&waiter->list_elem);
+        waiter->address = (uintptr_t) target;
+        list_append(&target_bucket->waiters, &waiter->list_elem);
+        __atomic_store_n(&waiter->bucket, target_bucket, __ATOMIC_RELEASE);
+        requeued++;
+    }
+    count = woken + requeued;
+
+    unlock:
+    if(target_bucket != bucket) spinlock_release(&target_bucket->lock);
+    spinlock_release(&bucket->lock);
+    ipl(old_ipl);
+    return count;
+}
\ No newline at end of file
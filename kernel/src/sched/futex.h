@@ -0,0 +1,28 @@
+#pragma once
+#include <stddef.h>
+#include <memory/vmm.h>
+#include <sys/time.h>
+
+/**
+ * @brief Block the current thread until woken, if the futex still holds the expected value
+ * @param address_space address space of the futex
+ * @param address userspace address of the futex
+ * @param timeout relative timeout, NULL to wait indefinitely
+ * @returns 0 when woken, -EAGAIN on a value mismatch, -ETIMEDOUT, -EFAULT, -EINTR when the process is exiting
+ */
+int futex_wait(vmm_address_space_t *address_space, int *address, int expected, time_t *timeout);
+
+/**
+ * @brief Wake threads waiting on a futex
+ * @param count maximum number of threads to wake
+ * @returns number of threads woken
+ */
+size_t futex_wake(vmm_address_space_t *address_space, int *address, size_t count);
+
+/**
+ * @brief Wake threads waiting on a futex and move the remaining waiters to another futex
+ * @param wake_count maximum number of threads to wake
+ * @param requeue_count maximum number of threads to move to the target futex
+ * @returns number of threads woken and requeued, -EAGAIN on a value mismatch, -EFAULT
+ */
+long futex_requeue(vmm_address_space_t *address_space, int *address, int expected, size_t wake_count, int *target, size_t requeue_count);
\ No newline at end of file
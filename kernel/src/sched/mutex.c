@@ -0,0 +1,62 @@
+#include "mutex.h"
+#include <common/assert.h>
+#include <sched/thread.h>
+#include <sched/preempt.h>
+#include <arch/sched.h>
+#include <arch/cpu.h>
+
+#define DEADLOCK_AT 100000000
+
+/*
+    Waiters announce themselves before checking the owner and the releaser clears the owner before checking for waiters,
+    so at least one side always sees the other. The check runs under the wait queue lock, a wakeup therefore finds the waiter queued.
+*/
+
+static bool mutex_free(void *data) {
+    mutex_t *mutex = (mutex_t *) data;
+    __atomic_add_fetch(&mutex->waiters, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&mutex->owner, __ATOMIC_SEQ_CST) == NULL) {
+        __atomic_sub_fetch(&mutex->waiters, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+    return false;
+}
+
+/*
+    A destroyed owner is harmless, heap memory is never unmapped and its cpu field reads as NULL or stale,
+    the owner recheck ends the spin either way.
+*/
+static bool owner_running(mutex_t *mutex, thread_t *owner) {
+    return __atomic_load_n(&owner->cpu, __ATOMIC_RELAXED) != NULL && __atomic_load_n(&mutex->owner, __ATOMIC_RELAXED) == owner;
+}
+
+bool mutex_try_acquire(mutex_t *mutex) {
+    thread_t *expected = NULL;
+    return __atomic_compare_exchange_n(&mutex->owner, &expected, arch_sched_thread_current(), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutex_acquire(mutex_t *mutex) {
+    thread_t *current = arch_sched_thread_current();
+    ASSERT(__atomic_load_n(&mutex->owner, __ATOMIC_RELAXED) != current);
+
+    bool can_block = preempt_can_block();
+    uint64_t dead = 0;
+    while(!mutex_try_acquire(mutex)) {
+        thread_t *owner;
+        while((owner = __atomic_load_n(&mutex->owner, __ATOMIC_RELAXED)) != NULL) {
+            if(can_block && !owner_running(mutex, owner)) break;
+            // Only a caller that cannot block spins without bound, on an owner that was switched out on its own CPU
+            ASSERT(can_block || dead++ != DEADLOCK_AT);
+            arch_cpu_relax();
+        }
+        if(owner == NULL) continue;
+
+        if(waitqueue_wait_unless(&mutex->waitqueue, mutex_free, mutex)) __atomic_sub_fetch(&mutex->waiters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void mutex_release(mutex_t *mutex) {
+    ASSERT(__atomic_load_n(&mutex->owner, __ATOMIC_RELAXED) == arch_sched_thread_current());
+    __atomic_store_n(&mutex->owner, NULL, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&mutex->waiters, __ATOMIC_SEQ_CST) != 0) waitqueue_wake_one(&mutex->waitqueue);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <sched/waitqueue.h>
+
+#define MUTEX_INIT(NAME) (mutex_t) { .owner = NULL, .waiters = 0, .waitqueue = { .lock = {}, .threads = { .next = &(NAME).waitqueue.threads, .prev = &(NAME).waitqueue.threads } } }
+
+/*
+    Sleeping mutex with adaptive spinning. A waiter spins as long as the owner is running on another CPU,
+    since the lock is likely handed over before a switch would pay off, and blocks once the owner is switched out.
+    Code that cannot block (preemption disabled, interrupts masked or a raised IPL) only ever spins and must not use a mutex
+    that can be held by code running on the same CPU, a switched out owner would never get to run again.
+*/
+typedef struct {
+    struct thread *owner; // NULL when unlocked
+    uint32_t waiters; // Threads on the wait queue or about to join it
+    waitqueue_t waitqueue;
+} mutex_t;
+
+/**
+ * @brief Acquire a mutex, may block
+ * @warning Not recursive, must not be held across a return to user space. Callers that cannot block only spin, see above
+ */
+void mutex_acquire(mutex_t *mutex);
+
+/**
+ * @brief Try to acquire a mutex
+ * @warning Does not spin or block, only tries to acquire the mutex once
+ * @returns true = acquired the mutex
+ */
+bool mutex_try_acquire(mutex_t *mutex);
+
+/**
+ * @brief Release a mutex, wakes one waiter
+ * @warning Only the owner may release it
+ */
+void mutex_release(mutex_t *mutex);
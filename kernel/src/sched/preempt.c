@@ -0,0 +1,34 @@
+#include "preempt.h"
+#include <common/assert.h>
+#include <sched/thread.h>
+#include <sys/ipl.h>
+#include <arch/sched.h>
+#include <arch/interrupt.h>
+
+/*
+    The count is only ever modified by its own thread, interrupts on the same CPU merely read it.
+    Compiler fences keep accesses inside the protected region from moving across the count updates.
+*/
+
+void preempt_disable() {
+    arch_sched_thread_current()->preempt_count++;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+}
+
+void preempt_enable() {
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    thread_t *current = arch_sched_thread_current();
+    ASSERT(current->preempt_count > 0);
+    if(--current->preempt_count == 0) preempt_check();
+}
+
+bool preempt_can_block() {
+    // Interrupt handlers and code at a raised IPL cannot switch, the IPL is not saved per thread
+    return arch_sched_thread_current()->preempt_count == 0 && arch_interrupt_enabled() && arch_interrupt_get_ipl() == IPL_SCHED;
+}
+
+void preempt_check() {
+    // The scheduler timer retries for code that cannot switch right now
+    if(!__atomic_load_n(&arch_sched_thread_current()->preempt_pending, __ATOMIC_RELAXED) || !preempt_can_block()) return;
+    arch_sched_yield();
+}
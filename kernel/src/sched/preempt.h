@@ -0,0 +1,24 @@
+#pragma once
+
+/**
+ * @brief Disable preemption of the current thread, calls nest
+ * @note Every held spinlock disables preemption, a scheduler interrupt in the meantime is deferred until it is enabled again
+ */
+void preempt_disable();
+
+/**
+ * @brief Enable preemption of the current thread, performs a preemption that was deferred meanwhile
+ */
+void preempt_enable();
+
+/**
+ * @brief Test if the current thread may block or yield right now
+ * @returns false with preemption disabled, interrupts masked or at a raised IPL
+ */
+bool preempt_can_block();
+
+/**
+ * @brief Perform a deferred preemption if the current thread can be switched out right now
+ * @note Called when preemption or the IPL drop back down, long running kernel code can call it as a safe point
+ */
+void preempt_check();
@@ -10,7 +10,10 @@ typedef struct process {
     spinlock_t lock;
     vmm_address_space_t *address_space;
     vfs_node_t *cwd;
+    bool exiting; // Threads are destroyed as they leave their CPU
     resource_table_t resource_table;
     list_t threads;
+    uint64_t user_time; // CPU time in nanoseconds of exited threads, protected by lock
+    uint64_t system_time;
     list_element_t list_sched;
 } process_t;
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include "rcu.h"
+#include <common/assert.h>
+#include <sys/cpu.h>
+#include <sched/sched.h>
+#include <sched/thread.h>
+#include <arch/sched.h>
+#include <arch/cpu.h>
+
+static uint64_t g_generation = 0;
+
+uint64_t rcu_generation() {
+    return __atomic_load_n(&g_generation, __ATOMIC_SEQ_CST);
+}
+
+void rcu_quiescent() {
+    thread_t *current = arch_sched_thread_current();
+    if(current->preempt_count != 0 || current->cpu == NULL) return;
+    __atomic_store_n(&current->cpu->rcu_generation, rcu_generation(), __ATOMIC_SEQ_CST);
+}
+
+void rcu_synchronize() {
+    ASSERT(arch_sched_thread_current()->preempt_count == 0);
+    uint64_t target = __atomic_add_fetch(&g_generation, 1, __ATOMIC_SEQ_CST);
+
+    // Idle and tickless CPUs might not schedule on their own, kick the lagging ones once
+    size_t cpu_count = sched_cpu_count();
+    for(size_t i = 0; i < cpu_count; i++) {
+        cpu_t *cpu = sched_cpu(i);
+        if(cpu == cpu_current() || __atomic_load_n(&cpu->rcu_generation, __ATOMIC_SEQ_CST) >= target) continue;
+        arch_sched_preempt(cpu);
+    }
+
+    // OPTIMIZE: Every waiter polls all CPUs, concurrent callers could share a grace period
+    for(size_t i = 0; i < cpu_count; i++) {
+        cpu_t *cpu = sched_cpu(i);
+        while(__atomic_load_n(&cpu->rcu_generation, __ATOMIC_SEQ_CST) < target) {
+            arch_sched_yield();
+            arch_cpu_relax();
+        }
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <stdint.h>
+#include <lib/list.h>
+#include <sched/preempt.h>
+
+/*
+    Quiescent state based RCU. Read sections only disable preemption, so they cost no shared writes.
+    A CPU passing through the scheduler with preemption enabled is outside of any read section,
+    a grace period ends once every CPU has done so after it started.
+*/
+
+/**
+ * @brief Publish a pointer to readers, everything written before is visible to them
+ */
+#define RCU_ASSIGN(POINTER, VALUE) __atomic_store_n(&(POINTER), (VALUE), __ATOMIC_RELEASE)
+
+/**
+ * @brief Read a pointer published with RCU_ASSIGN
+ */
+#define RCU_DEREFERENCE(POINTER) __atomic_load_n(&(POINTER), __ATOMIC_ACQUIRE)
+
+/**
+ * @brief Iterate over a list modified with the rcu_list functions
+ * @warning Only valid within a read section
+ */
+#define RCU_LIST_FOREACH(LIST, ELEM_PTR_NAME) list_element_t *(ELEM_PTR_NAME); for((ELEM_PTR_NAME) = RCU_DEREFERENCE((LIST)->next); (ELEM_PTR_NAME) && (ELEM_PTR_NAME) != (LIST); (ELEM_PTR_NAME) = RCU_DEREFERENCE((ELEM_PTR_NAME)->next))
+
+/**
+ * @brief Enter a read section, protected data stays valid until rcu_read_unlock
+ * @warning Must not block or yield within the section
+ */
+static inline void rcu_read_lock() {
+    preempt_disable();
+}
+
+/**
+ * @brief Leave a read section
+ */
+static inline void rcu_read_unlock() {
+    preempt_enable();
+}
+
+/**
+ * @brief Wait for a grace period, every read section that might still see removed data has finished afterwards
+ * @warning Must not be called within a read section or with a spinlock held
+ */
+void rcu_synchronize();
+
+/**
+ * @brief Current grace period generation, CPUs registering with the scheduler start out at it
+ */
+uint64_t rcu_generation();
+
+/**
+ * @brief Record a quiescent state for the current CPU
+ * @note Called by the scheduler on every scheduling decision
+ */
+void rcu_quiescent();
+
+/**
+ * @brief Insert an element behind another, concurrent readers see the list either with or without it
+ * @warning Writers have to be serialized
+ */
+static inline void rcu_list_append(list_element_t *position, list_element_t *element) {
+    element->prev = position;
+    element->next = position->next;
+    if(position->next) position->next->prev = element;
+    RCU_ASSIGN(position->next, element);
+}
+
+/**
+ * @brief Insert an element before another, concurrent readers see the list either with or without it
+ * @warning Writers have to be serialized
+ */
+static inline void rcu_list_prepend(list_element_t *position, list_element_t *element) {
+    element->next = position;
+    element->prev = position->prev;
+    if(position->prev) RCU_ASSIGN(position->prev->next, element);
+    position->prev = element;
+}
+
+/**
+ * @brief Unlink an element, readers standing on it can still move on
+ * @warning Writers have to be serialized, the element may only be reused after a grace period
+ */
+static inline void rcu_list_delete(list_element_t *element) {
+    if(element->prev) RCU_ASSIGN(element->prev->next, element->next);
+    if(element->next) element->next->prev = element->prev;
+}
@@ -4,12 +4,20 @@
 #include <common/spinlock.h>
 #include <memory/heap.h>
 
+static void resource_release(resource_t *resource) {
+    if(__atomic_sub_fetch(&resource->refcount, 1, __ATOMIC_ACQ_REL) != 0) return;
+    vfs_node_unref(resource->node);
+    heap_free(resource);
+}
+
 resource_t *resource_create_at(resource_table_t *table, int id, vfs_node_t *node, size_t offset, resource_mode_t mode, bool lock) {
     if(lock) spinlock_acquire(&table->lock);
     resource_t *resource = heap_alloc(sizeof(resource_t));
+    vfs_node_ref(node);
     resource->node = node;
     resource->offset = offset;
     resource->mode = mode;
+    resource->refcount = 1;
     table->resources[id] = resource;
     if(lock) spinlock_release(&table->lock);
     log(LOG_LEVEL_DEBUG, "RESOURCE", "Created resource %i (offset: %#lx, mode: %i)", id, offset, mode);
@@ -40,7 +48,7 @@ int resource_remove(resource_table_t *table, int id) {
         spinlock_release(&table->lock);
         return -EBADF;
     }
-    heap_free(table->resources[id]);
+    resource_release(table->resources[id]);
     table->resources[id] = NULL;
     spinlock_release(&table->lock);
     return 0;
@@ -53,4 +61,18 @@ resource_t *resource_get(resource_table_t *table, int id) {
     if(table->resources[id] != NULL) resource = table->resources[id];
     spinlock_release(&table->lock);
     return resource;
+}
+
+void resource_table_copy(resource_table_t *dest, resource_table_t *src) {
+    spinlock_acquire(&src->lock);
+    spinlock_acquire(&dest->lock);
+    for(int id = 0; id < src->count && id < dest->count; id++) {
+        resource_t *resource = src->resources[id];
+        if(resource == NULL) continue;
+        __atomic_add_fetch(&resource->refcount, 1, __ATOMIC_RELAXED);
+        if(dest->resources[id] != NULL) resource_release(dest->resources[id]);
+        dest->resources[id] = resource;
+    }
+    spinlock_release(&dest->lock);
+    spinlock_release(&src->lock);
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include <stddef.h>
+#include <stdint.h>
 #include <fs/vfs.h>
 #include <common/spinlock.h>
 
@@ -10,10 +11,12 @@ typedef enum {
     RESOURCE_MODE_REFERENCE
 } resource_mode_t;
 
+/* Open file description, forked tables share it and with it the offset */
 typedef struct resource {
     vfs_node_t *node;
     size_t offset;
     resource_mode_t mode;
+    uint32_t refcount; // Table entries referring to this resource
 } resource_t;
 
 typedef struct resource_table {
@@ -36,7 +39,7 @@ int resource_create(resource_table_t *table, vfs_node_t *node, size_t offset, re
 resource_t *resource_create_at(resource_table_t *table, int id, vfs_node_t *node, size_t offset, resource_mode_t mode, bool lock);
 
 /**
- * @brief Removes a resource from the table
+ * @brief Removes a resource from the table, the resource is freed once no table refers to it anymore
  * @param id resource id
  * @returns -errno on failure, 0 on success
  */
@@ -46,4 +49,10 @@ int resource_remove(resource_table_t *table, int id);
  * @brief Retrieve a resource from a process
  * @param id resource id
  */
-resource_t *resource_get(resource_table_t *table, int id);
\ No newline at end of file
+resource_t *resource_get(resource_table_t *table, int id);
+
+/**
+ * @brief Copy every resource of a table into another table, the copies share the resources with the original
+ * @param dest destination table, resources in it will be overwritten
+ */
+void resource_table_copy(resource_table_t *dest, resource_table_t *src);
\ No newline at end of file
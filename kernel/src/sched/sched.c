@@ -2,20 +2,307 @@
 #include <lib/list.h>
 #include <lib/mem.h>
 #include <common/spinlock.h>
+#include <common/assert.h>
 #include <memory/heap.h>
 #include <sched/thread.h>
+#include <sched/rcu.h>
 #include <sys/cpu.h>
+#include <sys/time.h>
+#include <sys/ipl.h>
 #include <arch/sched.h>
+#include <arch/time.h>
 
 #define DEFAULT_RESOURCE_COUNT 256
+#define SCHED_MAX_CPUS 256
+#define NICE_0_WEIGHT 1024
+#define SCHED_BALANCE_INTERVAL 4'000'000 // Period in nanoseconds of load average updates and balancing
+#define SCHED_BALANCE_IMBALANCE_LOCAL 125 // Percentage of the local load a CPU in the same cache domain has to exceed to be pulled from
+#define SCHED_BALANCE_IMBALANCE_REMOTE 150 // Same for CPUs in other cache domains, as migrating there leaves the caches cold
+
+static_assert(SCHED_MAX_CPUS <= THREAD_AFFINITY_MAX_CPUS);
 
 static long g_next_pid = 1;
 
 static spinlock_t g_sched_processes_lock = SPINLOCK_INIT;
 list_t g_sched_processes = LIST_INIT;
 
-static spinlock_t g_sched_threads_lock = SPINLOCK_INIT;
-list_t g_sched_threads_queued = LIST_INIT_CIRCULAR(g_sched_threads_queued);
+static spinlock_t g_sched_cpus_lock = SPINLOCK_INIT;
+static cpu_t *g_sched_cpus[SCHED_MAX_CPUS];
+static size_t g_sched_cpu_count = 0;
+
+static timer_t g_sched_balance_timer;
+
+// Threads scheduled before any CPU was registered
+static list_t g_sched_threads_pending = LIST_INIT_CIRCULAR(g_sched_threads_pending);
+
+static const uint64_t g_nice_weights[SCHED_NICE_MAX - SCHED_NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906,
+    3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423,
+    335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45,
+    36, 29, 23, 18, 15
+};
+
+static uint64_t thread_weight(thread_t *thread) {
+    return g_nice_weights[thread->nice - SCHED_NICE_MIN];
+}
+
+static bool thread_allowed(thread_t *thread, cpu_t *cpu) {
+    return (__atomic_load_n(&thread->affinity.bits[cpu->id / 64], __ATOMIC_RELAXED) & (1ul << (cpu->id % 64))) != 0;
+}
+
+/* A thread in a syscall might hold locks, it is only destroyed once it leaves the syscall (see sched_thread_syscall_exit) */
+static bool thread_exiting(thread_t *thread) {
+    if(thread->state == THREAD_STATE_DESTROY) return true;
+    if(thread->proc == NULL || thread->in_syscall) return false;
+    return __atomic_load_n(&thread->proc->exiting, __ATOMIC_ACQUIRE);
+}
+
+static void thread_account(thread_t *thread, uint64_t now) {
+    if(now <= thread->run_start) return;
+    uint64_t delta = now - thread->run_start;
+    thread->run_start = now;
+    thread->runtime += delta;
+    thread->vruntime += delta * NICE_0_WEIGHT / thread_weight(thread);
+}
+
+/** @warning Has to run on the CPU of the thread, without being preempted */
+static void thread_cputime_charge(thread_t *thread) {
+    uint64_t now = arch_time_counter();
+    uint64_t delta = now > thread->cputime_start ? now - thread->cputime_start : 0;
+    thread->cputime_start = now;
+    // Kernel threads only ever run in the kernel, interrupts taken in user mode are charged to user time
+    if(thread->proc == NULL || thread->in_syscall) {
+        __atomic_store_n(&thread->system_time, thread->system_time + delta, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(&thread->user_time, thread->user_time + delta, __ATOMIC_RELAXED);
+    }
+}
+
+/** @warning Has to run on the CPU switching, without being preempted */
+static void stats_switch(cpu_t *cpu, thread_t *current, thread_t *next, bool voluntary) {
+    uint64_t now = arch_time_counter();
+    if(current != cpu->idle_thread) {
+        sched_histogram_add(&cpu->stats.slice, now > current->stats.slice_start ? now - current->stats.slice_start : 0);
+        if(voluntary) {
+            current->stats.voluntary++;
+            __atomic_store_n(&cpu->stats.voluntary, cpu->stats.voluntary + 1, __ATOMIC_RELAXED);
+        } else {
+            current->stats.involuntary++;
+            __atomic_store_n(&cpu->stats.involuntary, cpu->stats.involuntary + 1, __ATOMIC_RELAXED);
+        }
+    }
+    if(next == cpu->idle_thread) return;
+
+    uint64_t latency = now > next->stats.ready_time ? now - next->stats.ready_time : 0;
+    sched_histogram_add(&cpu->stats.latency, latency);
+    next->stats.runs++;
+    next->stats.latency_total += latency;
+    if(latency > next->stats.latency_max) next->stats.latency_max = latency;
+    if(next->last_cpu != NULL && next->last_cpu != cpu) {
+        next->stats.migrations++;
+        __atomic_store_n(&cpu->stats.migrations, cpu->stats.migrations + 1, __ATOMIC_RELAXED);
+    }
+    next->stats.slice_start = now;
+}
+
+/** @warning Assumes run queue lock is acquired */
+static void queue_insert(cpu_t *cpu, thread_t *thread) {
+    if(thread->policy == THREAD_POLICY_IDLE) {
+        list_prepend(&cpu->run_queue.idle_queue, &thread->list_sched);
+    } else {
+        // OPTIMIZE: sorted insertion is linear in the number of queued threads
+        list_element_t *position = &cpu->run_queue.queue;
+        LIST_FOREACH(&cpu->run_queue.queue, elem) {
+            if(LIST_CONTAINER_GET(elem, thread_t, list_sched)->vruntime <= thread->vruntime) continue;
+            position = elem;
+            break;
+        }
+        list_prepend(position, &thread->list_sched);
+        cpu->run_queue.weight += thread_weight(thread);
+    }
+    __atomic_store_n(&cpu->run_queue.count, cpu->run_queue.count + 1, __ATOMIC_RELAXED);
+}
+
+/** @warning Assumes run queue lock is acquired */
+static void queue_remove(cpu_t *cpu, thread_t *thread) {
+    list_delete(&thread->list_sched);
+    if(thread->policy != THREAD_POLICY_IDLE) cpu->run_queue.weight -= thread_weight(thread);
+    __atomic_store_n(&cpu->run_queue.count, cpu->run_queue.count - 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Fairest queued thread, normal threads always take precedence over the idle class
+ * @warning Assumes run queue lock is acquired
+ */
+static thread_t *queue_peek(cpu_t *cpu) {
+    if(!list_is_empty(&cpu->run_queue.queue)) return LIST_CONTAINER_GET(cpu->run_queue.queue.next, thread_t, list_sched);
+    if(!list_is_empty(&cpu->run_queue.idle_queue)) return LIST_CONTAINER_GET(cpu->run_queue.idle_queue.next, thread_t, list_sched);
+    return NULL;
+}
+
+/**
+ * @brief Fairest queued thread that is allowed to run on target and not heavier than max_weight
+ * @warning Assumes run queue lock is acquired
+ */
+static thread_t *queue_peek_allowed(cpu_t *cpu, cpu_t *target, uint64_t max_weight) {
+    // OPTIMIZE: Linear scan, threads pinned away from target are skipped one by one
+    LIST_FOREACH(&cpu->run_queue.queue, elem) {
+        thread_t *thread = LIST_CONTAINER_GET(elem, thread_t, list_sched);
+        if(thread_allowed(thread, target) && thread_weight(thread) <= max_weight) return thread;
+    }
+    if(max_weight == UINT64_MAX) {
+        LIST_FOREACH(&cpu->run_queue.idle_queue, idle_elem) {
+            thread_t *thread = LIST_CONTAINER_GET(idle_elem, thread_t, list_sched);
+            if(thread_allowed(thread, target)) return thread;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Remove a queued thread for migration, carrying its lag relative to the source over to the destination
+ * @warning Assumes the run queue lock of from is acquired
+ */
+static void queue_migrate(cpu_t *from, cpu_t *to, thread_t *thread) {
+    queue_remove(from, thread);
+    uint64_t lag = thread->vruntime > from->run_queue.min_vruntime ? thread->vruntime - from->run_queue.min_vruntime : 0;
+    thread->vruntime = __atomic_load_n(&to->run_queue.min_vruntime, __ATOMIC_RELAXED) + lag;
+}
+
+/** @brief Queue a thread on a CPU, wakeups reach this from interrupt handlers so the lock is taken at IPL critical */
+static void run_queue_push(cpu_t *cpu, thread_t *thread) {
+    ipl_t old_ipl = spinlock_acquire_irqsave(&cpu->run_queue.lock);
+    // Threads returning from sleep or migrating get at most half a latency period of credit
+    uint64_t floor = cpu->run_queue.min_vruntime > SCHED_LATENCY / 2 ? cpu->run_queue.min_vruntime - SCHED_LATENCY / 2 : 0;
+    if(thread->vruntime < floor) thread->vruntime = floor;
+    queue_insert(cpu, thread);
+    bool preempt = cpu->run_queue.tickless;
+    cpu->run_queue.tickless = false;
+    spinlock_release_irqrestore(&cpu->run_queue.lock, old_ipl);
+
+    if(preempt) arch_sched_preempt(cpu);
+}
+
+/** @brief Pick the allowed CPU with the least queued threads, NULL if there is none */
+static cpu_t *least_loaded_cpu(thread_t *thread) {
+    size_t cpu_count = __atomic_load_n(&g_sched_cpu_count, __ATOMIC_ACQUIRE);
+    cpu_t *target = NULL;
+    for(size_t i = 0; i < cpu_count; i++) {
+        if(!thread_allowed(thread, g_sched_cpus[i])) continue;
+        if(target != NULL && __atomic_load_n(&g_sched_cpus[i]->run_queue.count, __ATOMIC_RELAXED) >= __atomic_load_n(&target->run_queue.count, __ATOMIC_RELAXED)) continue;
+        target = g_sched_cpus[i];
+    }
+    return target;
+}
+
+/** @brief Find an allowed CPU that is idle with nothing queued, NULL if there is none */
+static cpu_t *idle_cpu(thread_t *thread) {
+    size_t cpu_count = __atomic_load_n(&g_sched_cpu_count, __ATOMIC_ACQUIRE);
+    for(size_t i = 0; i < cpu_count; i++) {
+        if(!thread_allowed(thread, g_sched_cpus[i])) continue;
+        if(!__atomic_load_n(&g_sched_cpus[i]->run_queue.idle, __ATOMIC_RELAXED)) continue;
+        if(__atomic_load_n(&g_sched_cpus[i]->run_queue.count, __ATOMIC_RELAXED) != 0) continue;
+        return g_sched_cpus[i];
+    }
+    return NULL;
+}
+
+/** @brief Take a thread from the busiest other CPU */
+static thread_t *steal(cpu_t *thief) {
+    size_t cpu_count = __atomic_load_n(&g_sched_cpu_count, __ATOMIC_ACQUIRE);
+    cpu_t *victim = NULL;
+    size_t victim_count = 0;
+    for(size_t i = 0; i < cpu_count; i++) {
+        if(g_sched_cpus[i] == thief) continue;
+        size_t count = __atomic_load_n(&g_sched_cpus[i]->run_queue.count, __ATOMIC_RELAXED);
+        if(count <= victim_count) continue;
+        victim = g_sched_cpus[i];
+        victim_count = count;
+    }
+    if(victim == NULL) return NULL;
+
+    spinlock_acquire(&victim->run_queue.lock);
+    thread_t *thread = queue_peek_allowed(victim, thief, UINT64_MAX);
+    if(thread != NULL) queue_migrate(victim, thief, thread);
+    spinlock_release(&victim->run_queue.lock);
+    return thread;
+}
+
+/**
+ * @brief Fold the current runnable weight into the load average of a CPU
+ * @returns true if at least one balance interval passed since the last update
+ */
+static bool load_update(cpu_t *cpu, uint64_t load, uint64_t now) {
+    if(now < cpu->run_queue.load_update + SCHED_BALANCE_INTERVAL) return false;
+    uint64_t periods = (now - cpu->run_queue.load_update) / SCHED_BALANCE_INTERVAL;
+    cpu->run_queue.load_update += periods * SCHED_BALANCE_INTERVAL;
+
+    // Every period keeps three quarters of the history, after 16 periods nothing of it is left to speak of
+    uint64_t load_avg = cpu->run_queue.load_avg;
+    if(periods >= 16) {
+        load_avg = load;
+    } else {
+        while(periods--) load_avg = (load_avg * 3 + load) / 4;
+    }
+    __atomic_store_n(&cpu->run_queue.load_avg, load_avg, __ATOMIC_RELAXED);
+    return true;
+}
+
+/** @brief Pull a thread from a clearly busier CPU, preferring CPUs that share the last level cache */
+static void balance(cpu_t *cpu) {
+    uint64_t load_avg = cpu->run_queue.load_avg;
+    size_t cpu_count = __atomic_load_n(&g_sched_cpu_count, __ATOMIC_ACQUIRE);
+    cpu_t *victim = NULL;
+    uint64_t victim_score = 0;
+    for(size_t i = 0; i < cpu_count; i++) {
+        cpu_t *candidate = g_sched_cpus[i];
+        if(candidate == cpu || __atomic_load_n(&candidate->run_queue.count, __ATOMIC_RELAXED) == 0) continue;
+
+        // Hysteresis, a CPU has to be busier by a margin so threads do not bounce between similarly loaded CPUs
+        uint64_t imbalance = candidate->cache_domain == cpu->cache_domain ? SCHED_BALANCE_IMBALANCE_LOCAL : SCHED_BALANCE_IMBALANCE_REMOTE;
+        uint64_t load = __atomic_load_n(&candidate->run_queue.load_avg, __ATOMIC_RELAXED);
+        if(load * 100 <= load_avg * imbalance) continue;
+
+        uint64_t score = load * 100 / imbalance;
+        if(score <= victim_score) continue;
+        victim = candidate;
+        victim_score = score;
+    }
+    if(victim == NULL) return;
+
+    // Only move a thread light enough that the imbalance does not simply flip around
+    uint64_t victim_load = __atomic_load_n(&victim->run_queue.load_avg, __ATOMIC_RELAXED);
+    uint64_t max_weight = (victim_load - load_avg) / 2;
+
+    spinlock_acquire(&victim->run_queue.lock);
+    thread_t *thread = queue_peek_allowed(victim, cpu, max_weight);
+    if(thread != NULL) queue_migrate(victim, cpu, thread);
+    spinlock_release(&victim->run_queue.lock);
+    if(thread == NULL) return;
+
+    spinlock_acquire(&cpu->run_queue.lock);
+    queue_insert(cpu, thread);
+    spinlock_release(&cpu->run_queue.lock);
+}
+
+/**
+ * @brief Kick tickless CPUs into a scheduling pass while threads are queued, they would not balance or steal on their own
+ * @note Runs from the clock interrupt, the kicked CPUs do the actual balancing under their own locks
+ */
+static void balance_timer([[maybe_unused]] timer_t *timer) {
+    size_t cpu_count = __atomic_load_n(&g_sched_cpu_count, __ATOMIC_ACQUIRE);
+    bool queued = false;
+    for(size_t i = 0; i < cpu_count && !queued; i++) queued = __atomic_load_n(&g_sched_cpus[i]->run_queue.count, __ATOMIC_RELAXED) != 0;
+    if(!queued) return;
+
+    for(size_t i = 0; i < cpu_count; i++) {
+        if(__atomic_load_n(&g_sched_cpus[i]->run_queue.tickless, __ATOMIC_RELAXED)) arch_sched_preempt(g_sched_cpus[i]);
+    }
+}
 
 process_t *sched_process_create(vmm_address_space_t *address_space) {
     process_t *proc = heap_alloc(sizeof(process_t));
@@ -29,6 +316,9 @@ process_t *sched_process_create(vmm_address_space_t *address_space) {
     memset(resources, 0, sizeof(resource_t *) * proc->resource_table.count);
     proc->resource_table.resources = resources;
     proc->cwd = NULL;
+    proc->exiting = false;
+    proc->user_time = 0;
+    proc->system_time = 0;
 
     spinlock_acquire(&g_sched_processes_lock);
     list_append(&g_sched_processes, &proc->list_sched);
@@ -37,35 +327,309 @@ process_t *sched_process_create(vmm_address_space_t *address_space) {
 }
 
 void sched_process_destroy(process_t *proc) {
+    // The process list is walked with the process list lock held before process locks, drop ours to unlink
+    spinlock_release(&proc->lock);
+    spinlock_acquire(&g_sched_processes_lock);
+    list_delete(&proc->list_sched);
+    spinlock_release(&g_sched_processes_lock);
+
     for(int i = 0; i < proc->resource_table.count; i++) resource_remove(&proc->resource_table, i);
+    // Waits out anyone still inside the table, the lock has to be dropped again since it holds a preemption count
     spinlock_acquire(&proc->resource_table.lock);
+    spinlock_release(&proc->resource_table.lock);
     heap_free(proc->resource_table.resources);
+    vmm_address_space_destroy(proc->address_space);
     heap_free(proc);
 }
 
+void sched_process_exit(process_t *proc) {
+    // Pairs with the blocking store before an interruptible wait checks sched_thread_interrupted, one of the two sides sees the other
+    __atomic_store_n(&proc->exiting, true, __ATOMIC_SEQ_CST);
+
+    thread_t *current = arch_sched_thread_current();
+    spinlock_acquire(&proc->lock);
+    LIST_FOREACH(&proc->threads, elem) {
+        thread_t *thread = LIST_CONTAINER_GET(elem, thread_t, list_proc);
+        if(thread == current) continue;
+        // Waits that are not interruptible simply block again, the others return and their syscall ends
+        sched_thread_wake(thread);
+        cpu_t *cpu = __atomic_load_n(&thread->cpu, __ATOMIC_RELAXED);
+        if(cpu != NULL) arch_sched_preempt(cpu);
+    }
+    spinlock_release(&proc->lock);
+}
+
+void sched_thread_foreach(void (* callback)(thread_t *thread, void *data), void *data) {
+    spinlock_acquire(&g_sched_processes_lock);
+    LIST_FOREACH(&g_sched_processes, elem) {
+        process_t *proc = LIST_CONTAINER_GET(elem, process_t, list_sched);
+        spinlock_acquire(&proc->lock);
+        LIST_FOREACH(&proc->threads, thread_elem) callback(LIST_CONTAINER_GET(thread_elem, thread_t, list_proc), data);
+        spinlock_release(&proc->lock);
+    }
+    spinlock_release(&g_sched_processes_lock);
+}
+
+size_t sched_cpu_count() {
+    return __atomic_load_n(&g_sched_cpu_count, __ATOMIC_ACQUIRE);
+}
+
+cpu_t *sched_cpu(size_t index) {
+    if(index >= __atomic_load_n(&g_sched_cpu_count, __ATOMIC_ACQUIRE)) return NULL;
+    return g_sched_cpus[index];
+}
+
+void sched_cpu_init(cpu_t *cpu) {
+    cpu->run_queue.lock = SPINLOCK_INIT;
+    lockstat_register(&cpu->run_queue.lock, "run_queue");
+    lockstat_register(&g_sched_cpus_lock, "sched_cpus");
+    lockstat_register(&g_sched_processes_lock, "sched_processes");
+    cpu->run_queue.queue = LIST_INIT_CIRCULAR(cpu->run_queue.queue);
+    cpu->run_queue.idle_queue = LIST_INIT_CIRCULAR(cpu->run_queue.idle_queue);
+    cpu->run_queue.count = 0;
+    cpu->run_queue.weight = 0;
+    cpu->run_queue.min_vruntime = 0;
+    cpu->run_queue.idle = true;
+    cpu->run_queue.tickless = false;
+    cpu->run_queue.load_avg = 0;
+    cpu->run_queue.load_update = time_nanoseconds(g_time_monotonic);
+    memset(&cpu->stats, 0, sizeof(cpu->stats));
+    cpu->work = NULL;
+    cpu->rcu_generation = rcu_generation();
+
+    ipl_t old_ipl = spinlock_acquire_irqsave(&g_sched_cpus_lock);
+    ASSERT(g_sched_cpu_count < SCHED_MAX_CPUS);
+    cpu->id = g_sched_cpu_count;
+    while(!list_is_empty(&g_sched_threads_pending)) {
+        thread_t *thread = LIST_CONTAINER_GET(LIST_NEXT(&g_sched_threads_pending), thread_t, list_sched);
+        list_delete(&thread->list_sched);
+        queue_insert(cpu, thread);
+    }
+    g_sched_cpus[g_sched_cpu_count] = cpu;
+    __atomic_store_n(&g_sched_cpu_count, g_sched_cpu_count + 1, __ATOMIC_RELEASE);
+    spinlock_release_irqrestore(&g_sched_cpus_lock, old_ipl);
+
+    if(cpu->id == 0) timer_arm_periodic(&g_sched_balance_timer, (time_t) { .nanoseconds = SCHED_BALANCE_INTERVAL }, balance_timer);
+}
+
 void sched_thread_schedule(thread_t *thread) {
-    spinlock_acquire(&g_sched_threads_lock);
-    list_prepend(&g_sched_threads_queued, &thread->list_sched);
-    spinlock_release(&g_sched_threads_lock);
+    thread->state = THREAD_STATE_READY;
+    thread->stats.ready_time = arch_time_counter();
+
+    // Prefer the CPU the thread last ran on, unless it is busy while another CPU sits idle
+    cpu_t *cpu = thread->last_cpu;
+    if(cpu != NULL && !thread_allowed(thread, cpu)) cpu = NULL;
+    if(cpu == NULL || !__atomic_load_n(&cpu->run_queue.idle, __ATOMIC_RELAXED)) {
+        cpu_t *idle = idle_cpu(thread);
+        if(idle != NULL) cpu = idle;
+    }
+    if(cpu == NULL) cpu = least_loaded_cpu(thread);
+    if(cpu == NULL) {
+        ipl_t old_ipl = spinlock_acquire_irqsave(&g_sched_cpus_lock);
+        if(g_sched_cpu_count == 0) {
+            list_prepend(&g_sched_threads_pending, &thread->list_sched);
+            spinlock_release_irqrestore(&g_sched_cpus_lock, old_ipl);
+            return;
+        }
+        cpu = g_sched_cpus[0];
+        spinlock_release_irqrestore(&g_sched_cpus_lock, old_ipl);
+    }
+    run_queue_push(cpu, thread);
 }
 
-thread_t *sched_thread_next() {
-    spinlock_acquire(&g_sched_threads_lock);
-    if(list_is_empty(&g_sched_threads_queued)) {
-        spinlock_release(&g_sched_threads_lock);
-        return 0;
+thread_t *sched_thread_next(thread_t *current) {
+    cpu_t *cpu = current->cpu;
+    current->preempt_pending = false;
+    uint64_t now = time_nanoseconds(g_time_monotonic);
+    thread_state_t state = __atomic_load_n(&current->state, __ATOMIC_ACQUIRE);
+    // A thread whose affinity no longer includes this CPU is rescheduled elsewhere once dropped
+    bool runnable = current != cpu->idle_thread && state != THREAD_STATE_BLOCKING && !thread_exiting(current) && thread_allowed(current, cpu);
+    bool voluntary = state == THREAD_STATE_BLOCKING || state == THREAD_STATE_DESTROY;
+    if(current != cpu->idle_thread) {
+        thread_account(current, now);
+        thread_cputime_charge(current);
     }
-    thread_t *thread = LIST_CONTAINER_GET(g_sched_threads_queued.next, thread_t, list_sched);
-    list_delete(&thread->list_sched);
-    spinlock_release(&g_sched_threads_lock);
-    return thread;
+
+    spinlock_acquire(&cpu->run_queue.lock);
+    bool balance_due = load_update(cpu, cpu->run_queue.weight + (runnable ? thread_weight(current) : 0), now);
+    spinlock_release(&cpu->run_queue.lock);
+    if(balance_due) balance(cpu);
+
+    thread_t *next;
+    while(true) {
+        spinlock_acquire(&cpu->run_queue.lock);
+        uint64_t min_vruntime = runnable && current->policy == THREAD_POLICY_NORMAL ? current->vruntime : UINT64_MAX;
+        if(!list_is_empty(&cpu->run_queue.queue)) {
+            uint64_t head_vruntime = LIST_CONTAINER_GET(cpu->run_queue.queue.next, thread_t, list_sched)->vruntime;
+            if(head_vruntime < min_vruntime) min_vruntime = head_vruntime;
+        }
+        if(min_vruntime != UINT64_MAX && min_vruntime > cpu->run_queue.min_vruntime) __atomic_store_n(&cpu->run_queue.min_vruntime, min_vruntime, __ATOMIC_RELAXED);
+
+        next = queue_peek(cpu);
+        if(next != NULL && runnable && current->policy == THREAD_POLICY_NORMAL) {
+            // A normal thread keeps the CPU until it is no longer the fairest choice
+            if(next->policy == THREAD_POLICY_IDLE || next->vruntime >= current->vruntime) next = NULL;
+        }
+        if(next != NULL) queue_remove(cpu, next);
+        spinlock_release(&cpu->run_queue.lock);
+
+        if(next == NULL && !runnable) next = steal(cpu);
+        if(next == NULL) break;
+
+        // Queued threads of an exiting process are reaped instead of run
+        if(thread_exiting(next)) {
+            arch_sched_thread_destroy(next);
+            continue;
+        }
+
+        // Affinity changed while the thread was queued
+        if(!thread_allowed(next, cpu)) {
+            sched_thread_schedule(next);
+            continue;
+        }
+        break;
+    }
+    if(next == NULL) {
+        if(runnable || current == cpu->idle_thread) return NULL;
+        stats_switch(cpu, current, cpu->idle_thread, voluntary);
+        return cpu->idle_thread;
+    }
+    stats_switch(cpu, current, next, voluntary);
+    next->run_start = now;
+    next->cputime_start = arch_time_counter();
+    next->state = THREAD_STATE_ACTIVE;
+    return next;
+}
+
+uint64_t sched_thread_timeslice(thread_t *thread) {
+    cpu_t *cpu = thread->cpu;
+    bool idle = thread == cpu->idle_thread;
+
+    spinlock_acquire(&cpu->run_queue.lock);
+    __atomic_store_n(&cpu->run_queue.idle, idle, __ATOMIC_RELAXED);
+    // Nothing else to run, stop the timer until something is enqueued
+    bool tickless = cpu->run_queue.count == 0;
+    cpu->run_queue.tickless = tickless;
+    uint64_t queued_weight = cpu->run_queue.weight;
+    spinlock_release(&cpu->run_queue.lock);
+
+    if(tickless) return 0;
+    if(idle) return 1; // Work was enqueued while switching to idle, reschedule right away
+    if(thread->policy == THREAD_POLICY_IDLE) return SCHED_MIN_GRANULARITY;
+
+    uint64_t weight = thread_weight(thread);
+    uint64_t slice = SCHED_LATENCY * weight / (queued_weight + weight);
+    return slice < SCHED_MIN_GRANULARITY ? SCHED_MIN_GRANULARITY : slice;
+}
+
+void sched_thread_set_priority(thread_t *thread, thread_policy_t policy, int nice) {
+    ASSERT(nice >= SCHED_NICE_MIN && nice <= SCHED_NICE_MAX);
+    thread->policy = policy;
+    thread->nice = nice;
+}
+
+bool sched_thread_set_affinity(thread_t *thread, thread_affinity_t *affinity) {
+    bool any = false;
+    size_t cpu_count = __atomic_load_n(&g_sched_cpu_count, __ATOMIC_ACQUIRE);
+    for(size_t i = 0; i < cpu_count; i++) {
+        if((affinity->bits[i / 64] & (1ul << (i % 64))) != 0) any = true;
+    }
+    if(!any) return false;
+
+    // Published word by word, schedulers on other CPUs read the mask concurrently
+    for(size_t i = 0; i < sizeof(affinity->bits) / sizeof(affinity->bits[0]); i++) __atomic_store_n(&thread->affinity.bits[i], affinity->bits[i], __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if(thread == arch_sched_thread_current()) {
+        if(!thread_allowed(thread, thread->cpu)) arch_sched_yield();
+        return true;
+    }
+
+    // A thread running on an excluded CPU is only moved once that CPU schedules, which a tickless CPU would not do on its own
+    cpu_t *cpu = __atomic_load_n(&thread->cpu, __ATOMIC_RELAXED);
+    if(cpu != NULL && !thread_allowed(thread, cpu)) arch_sched_preempt(cpu);
+    return true;
+}
+
+void sched_thread_get_affinity(thread_t *thread, thread_affinity_t *affinity) {
+    *affinity = (thread_affinity_t) {};
+    size_t cpu_count = __atomic_load_n(&g_sched_cpu_count, __ATOMIC_ACQUIRE);
+    for(size_t i = 0; i < cpu_count; i++) affinity->bits[i / 64] |= __atomic_load_n(&thread->affinity.bits[i / 64], __ATOMIC_RELAXED) & (1ul << (i % 64));
+}
+
+void sched_thread_syscall_enter(thread_t *thread) {
+    thread_cputime_charge(thread);
+    thread->in_syscall = true;
+}
+
+void sched_thread_syscall_exit(thread_t *thread) {
+    thread_cputime_charge(thread);
+    thread->in_syscall = false;
+    if(thread->proc == NULL || !__atomic_load_n(&thread->proc->exiting, __ATOMIC_ACQUIRE)) return;
+    thread->state = THREAD_STATE_DESTROY;
+    arch_sched_yield();
+    __builtin_unreachable();
+}
+
+void sched_thread_cputime(thread_t *thread, uint64_t *user_time, uint64_t *system_time) {
+    if(thread == arch_sched_thread_current()) {
+        ipl_t old_ipl = ipl(IPL_CRITICAL);
+        thread_cputime_charge(thread);
+        ipl(old_ipl);
+    }
+    *user_time = __atomic_load_n(&thread->user_time, __ATOMIC_RELAXED);
+    *system_time = __atomic_load_n(&thread->system_time, __ATOMIC_RELAXED);
+}
+
+void sched_process_cputime(process_t *proc, uint64_t *user_time, uint64_t *system_time) {
+    thread_t *current = arch_sched_thread_current();
+    if(current->proc == proc) {
+        ipl_t old_ipl = ipl(IPL_CRITICAL);
+        thread_cputime_charge(current);
+        ipl(old_ipl);
+    }
+
+    spinlock_acquire(&proc->lock);
+    *user_time = proc->user_time;
+    *system_time = proc->system_time;
+    // OPTIMIZE: linear in the number of threads, other running threads are only charged up to their last switch or syscall
+    LIST_FOREACH(&proc->threads, elem) {
+        thread_t *thread = LIST_CONTAINER_GET(elem, thread_t, list_proc);
+        *user_time += __atomic_load_n(&thread->user_time, __ATOMIC_RELAXED);
+        *system_time += __atomic_load_n(&thread->system_time, __ATOMIC_RELAXED);
+    }
+    spinlock_release(&proc->lock);
+}
+
+void sched_thread_wake(thread_t *thread) {
+    thread_state_t state = __atomic_load_n(&thread->state, __ATOMIC_ACQUIRE);
+    while(true) {
+        switch(state) {
+            case THREAD_STATE_BLOCKING:
+                // Still on its CPU, it will notice it was woken when it tries to switch away
+                if(__atomic_compare_exchange_n(&thread->state, &state, THREAD_STATE_ACTIVE, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return;
+                break;
+            case THREAD_STATE_BLOCKED:
+                if(!__atomic_compare_exchange_n(&thread->state, &state, THREAD_STATE_READY, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) break;
+                sched_thread_schedule(thread);
+                return;
+            default: return;
+        }
+    }
+}
+
+bool sched_thread_interrupted() {
+    process_t *proc = arch_sched_thread_current()->proc;
+    return proc != NULL && __atomic_load_n(&proc->exiting, __ATOMIC_SEQ_CST);
 }
 
 void sched_thread_drop(thread_t *thread) {
     if(thread == cpu_current()->idle_thread) return;
-    if(thread->state == THREAD_STATE_DESTROY) {
+    if(thread_exiting(thread)) {
         arch_sched_thread_destroy(thread);
         return;
     }
+    thread_state_t state = THREAD_STATE_BLOCKING;
+    if(__atomic_compare_exchange_n(&thread->state, &state, THREAD_STATE_BLOCKED, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return;
     sched_thread_schedule(thread);
 }
\ No newline at end of file
@@ -2,6 +2,12 @@
 #include <memory/vmm.h>
 #include <sched/thread.h>
 #include <sched/process.h>
+#include <sys/cpu.h>
+
+#define SCHED_LATENCY 20'000'000 // Period in nanoseconds in which every runnable thread on a CPU should get to run
+#define SCHED_MIN_GRANULARITY 2'000'000 // Shortest time slice in nanoseconds
+#define SCHED_NICE_MIN (-20)
+#define SCHED_NICE_MAX 19
 
 /**
  * @brief Create a process
@@ -12,21 +18,110 @@ process_t *sched_process_create(vmm_address_space_t *address_space);
 
 /**
  * @brief Destroy a process
- * @warning Assumes you have acquired the process lock & process is not on the scheduler queue
+ * @warning Assumes you have acquired the process lock & process is not on the scheduler queue, the lock is released
  */
 void sched_process_destroy(process_t *proc);
 
 /**
- * @brief Schedule a thread
+ * @brief Mark a process as exiting, preempt the CPUs running its threads and wake its blocked threads
+ * @warning Threads in a syscall finish it first and are destroyed on their way back to user space
+ */
+void sched_process_exit(process_t *proc);
+
+/**
+ * @brief Call a function for every thread that belongs to a process
+ * @warning The callback runs with the process lock held
+ */
+void sched_thread_foreach(void (* callback)(thread_t *thread, void *data), void *data);
+
+/**
+ * @brief Number of CPUs registered with the scheduler
+ */
+size_t sched_cpu_count();
+
+/**
+ * @brief Get a CPU registered with the scheduler
+ * @param index cpu_t::id of the CPU
+ * @returns NULL if no CPU with that index is registered
+ */
+cpu_t *sched_cpu(size_t index);
+
+/**
+ * @brief Register a CPU with the scheduler and initialize its run queue
+ * @param cpu
+ */
+void sched_cpu_init(cpu_t *cpu);
+
+/**
+ * @brief Schedule a thread, threads are queued on the CPU they last ran on
  * @param thread
  */
 void sched_thread_schedule(thread_t *thread);
 
 /**
- * @brief Retrieve the next thread for execution
- * @return thread ready for execution
+ * @brief Account the current thread and pick the next thread to run on its CPU, stealing from other CPUs when the local queue is empty
+ * @param current thread running on the CPU
+ * @return thread to switch to, NULL if the current thread should keep running
+ * @note Satisfies a preemption of the current thread that was deferred
+ */
+thread_t *sched_thread_next(thread_t *current);
+
+/**
+ * @brief Length of the time slice for a thread that was just picked to run on its CPU
+ * @warning Records whether the CPU goes tickless, call after every scheduling decision
+ * @returns time slice in nanoseconds, 0 if the thread can run until another thread is enqueued
+ */
+uint64_t sched_thread_timeslice(thread_t *thread);
+
+/**
+ * @brief Set the scheduling policy and nice level of a thread
+ * @warning Thread should not be on the scheduler queue when this is called
+ */
+void sched_thread_set_priority(thread_t *thread, thread_policy_t policy, int nice);
+
+/**
+ * @brief Restrict the CPUs a thread may run on
+ * @note The calling thread migrates right away if it is no longer allowed on its CPU
+ * @returns false if the mask contains no registered CPU
+ */
+bool sched_thread_set_affinity(thread_t *thread, thread_affinity_t *affinity);
+
+/**
+ * @brief Get the CPUs a thread may run on, limited to the registered CPUs
+ */
+void sched_thread_get_affinity(thread_t *thread, thread_affinity_t *affinity);
+
+/**
+ * @brief Charge the time since the last switch or syscall as user time and mark the thread as in a syscall
+ * @warning Has to be called on the CPU of the thread, without being preempted
+ */
+void sched_thread_syscall_enter(thread_t *thread);
+
+/**
+ * @brief Charge the time spent in the syscall as system time, destroys the thread if its process is exiting
+ * @warning Has to be called on the CPU of the thread, without being preempted
+ */
+void sched_thread_syscall_exit(thread_t *thread);
+
+/**
+ * @brief Get the CPU time of a thread in nanoseconds, the time of the current thread is charged up to now
+ */
+void sched_thread_cputime(thread_t *thread, uint64_t *user_time, uint64_t *system_time);
+
+/**
+ * @brief Get the CPU time of all threads of a process in nanoseconds, including threads that have exited
+ */
+void sched_process_cputime(process_t *proc, uint64_t *user_time, uint64_t *system_time);
+
+/**
+ * @brief Make a blocking or blocked thread runnable again, safe to call from interrupt context
+ */
+void sched_thread_wake(thread_t *thread);
+
+/**
+ * @brief Test if the process of the current thread is exiting, interruptible waits give up on it
  */
-thread_t *sched_thread_next();
+bool sched_thread_interrupted();
 
 /**
  * @brief Called when a thread is dropped by a CPU
@@ -0,0 +1,34 @@
+#include "semaphore.h"
+#include <common/assert.h>
+#include <sched/preempt.h>
+
+/* Same waiter handshake as sched/mutex.c, the count takes the place of the owner */
+static bool semaphore_available(void *data) {
+    semaphore_t *semaphore = (semaphore_t *) data;
+    __atomic_add_fetch(&semaphore->waiters, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&semaphore->count, __ATOMIC_SEQ_CST) != 0) {
+        __atomic_sub_fetch(&semaphore->waiters, 1, __ATOMIC_RELAXED);
+        return true;
+    }
+    return false;
+}
+
+bool semaphore_try_wait(semaphore_t *semaphore) {
+    uint64_t count = __atomic_load_n(&semaphore->count, __ATOMIC_RELAXED);
+    while(count != 0) {
+        if(__atomic_compare_exchange_n(&semaphore->count, &count, count - 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return true;
+    }
+    return false;
+}
+
+void semaphore_wait(semaphore_t *semaphore) {
+    ASSERT(preempt_can_block());
+    while(!semaphore_try_wait(semaphore)) {
+        if(waitqueue_wait_unless(&semaphore->waitqueue, semaphore_available, semaphore)) __atomic_sub_fetch(&semaphore->waiters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void semaphore_signal(semaphore_t *semaphore) {
+    __atomic_add_fetch(&semaphore->count, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&semaphore->waiters, __ATOMIC_SEQ_CST) != 0) waitqueue_wake_one(&semaphore->waitqueue);
+}
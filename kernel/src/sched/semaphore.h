@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include <sched/waitqueue.h>
+
+#define SEMAPHORE_INIT(NAME, COUNT) (semaphore_t) { .count = (COUNT), .waiters = 0, .waitqueue = { .lock = {}, .threads = { .next = &(NAME).waitqueue.threads, .prev = &(NAME).waitqueue.threads } } }
+
+/* Counting semaphore, waiters block on a wait queue until the count is positive */
+typedef struct {
+    uint64_t count;
+    uint32_t waiters; // Threads on the wait queue or about to join it
+    waitqueue_t waitqueue;
+} semaphore_t;
+
+/**
+ * @brief Take one from the semaphore, blocks while the count is zero
+ * @warning Has to be able to block, see preempt_can_block
+ */
+void semaphore_wait(semaphore_t *semaphore);
+
+/**
+ * @brief Try to take one from the semaphore
+ * @returns true = the count was positive and got decremented
+ */
+bool semaphore_try_wait(semaphore_t *semaphore);
+
+/**
+ * @brief Give one to the semaphore and wake a waiter, safe to call from interrupt context
+ */
+void semaphore_signal(semaphore_t *semaphore);
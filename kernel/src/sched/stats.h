@@ -0,0 +1,19 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCHED_HISTOGRAM_BUCKETS 40 // Bucket n counts values in [2^n, 2^(n + 1)), the last bucket also counts everything above
+
+typedef struct {
+    uint64_t buckets[SCHED_HISTOGRAM_BUCKETS];
+} sched_histogram_t;
+
+/**
+ * @brief Count a value in a log2 histogram
+ * @warning Only supports a single writer, readers may observe a slightly stale count
+ */
+static inline void sched_histogram_add(sched_histogram_t *histogram, uint64_t value) {
+    size_t bucket = value == 0 ? 0 : 63 - __builtin_clzll(value);
+    if(bucket >= SCHED_HISTOGRAM_BUCKETS) bucket = SCHED_HISTOGRAM_BUCKETS - 1;
+    __atomic_store_n(&histogram->buckets[bucket], histogram->buckets[bucket] + 1, __ATOMIC_RELAXED);
+}
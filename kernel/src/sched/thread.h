@@ -1,19 +1,59 @@
 #pragma once
+#include <stdint.h>
 #include <lib/list.h>
 #include <sched/process.h>
+#include <sched/stats.h>
 #include <sys/cpu.h>
 
 typedef enum {
     THREAD_STATE_READY,
     THREAD_STATE_ACTIVE,
+    THREAD_STATE_BLOCKING, // Waiting on a wait queue but still switching off its CPU
+    THREAD_STATE_BLOCKED,
     THREAD_STATE_DESTROY
 } thread_state_t;
 
+typedef enum {
+    THREAD_POLICY_NORMAL,
+    THREAD_POLICY_IDLE
+} thread_policy_t;
+
+#define THREAD_AFFINITY_MAX_CPUS 256
+
+typedef struct {
+    uint64_t bits[THREAD_AFFINITY_MAX_CPUS / 64]; // Indexed by cpu_t::id
+} thread_affinity_t;
+
 typedef struct thread {
     long id;
     thread_state_t state;
     struct cpu *cpu;
+    struct cpu *last_cpu;
     process_t *proc;
+    thread_policy_t policy;
+    int nice;
+    thread_affinity_t affinity;
+    uint64_t vruntime;
+    uint64_t runtime;
+    uint64_t run_start;
+    uint64_t user_time; // CPU time in nanoseconds, measured with arch_time_counter
+    uint64_t system_time;
+    uint64_t cputime_start; // Counter value at the last time the thread was charged
+    bool in_syscall;
+    int preempt_count; // Preemption is deferred while non-zero, see sched/preempt.h
+    bool preempt_pending; // A scheduler interrupt arrived while preemption was disabled
+    struct {
+        uint64_t ready_time; // Counter value when the thread was last queued
+        uint64_t slice_start; // Counter value when the thread was last switched to
+        uint64_t runs;
+        uint64_t latency_total; // Nanoseconds spent queued before running
+        uint64_t latency_max;
+        uint64_t voluntary; // Switched away because it blocked or exited
+        uint64_t involuntary; // Switched away while still runnable
+        uint64_t migrations;
+    } stats;
+    struct waitqueue *waitqueue; // Wait queue the thread is on, protected by the lock of that queue
     list_element_t list_sched;
+    list_element_t list_wait;
     list_element_t list_proc;
 } thread_t;
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "waitqueue.h"
+#include <sched/sched.h>
+#include <sched/thread.h>
+#include <sys/ipl.h>
+#include <arch/sched.h>
+
+/*
+    Threads are queued through list_wait rather than list_sched, a thread can therefore be woken by something other
+    than the wait queue (see sched_process_exit) and run while still queued. It takes itself off the queue once it runs.
+*/
+
+static void enqueue(waitqueue_t *waitqueue, thread_t *thread) {
+    list_prepend(&waitqueue->threads, &thread->list_wait);
+    thread->waitqueue = waitqueue;
+}
+
+static void dequeue_self(waitqueue_t *waitqueue, thread_t *current) {
+    // Only the thread itself queues it again, a cleared pointer cannot change under it
+    if(__atomic_load_n(&current->waitqueue, __ATOMIC_ACQUIRE) == NULL) return;
+    ipl_t old_ipl = spinlock_acquire_irqsave(&waitqueue->lock);
+    if(current->waitqueue == waitqueue) {
+        list_delete(&current->list_wait);
+        current->waitqueue = NULL;
+    }
+    spinlock_release_irqrestore(&waitqueue->lock, old_ipl);
+}
+
+void waitqueue_wait(waitqueue_t *waitqueue, spinlock_t *lock) {
+    thread_t *current = arch_sched_thread_current();
+
+    ipl_t old_ipl = ipl(IPL_CRITICAL);
+    spinlock_acquire(&waitqueue->lock);
+    __atomic_store_n(&current->state, THREAD_STATE_BLOCKING, __ATOMIC_RELEASE);
+    enqueue(waitqueue, current);
+    spinlock_release(&waitqueue->lock);
+    if(lock != NULL) spinlock_release(lock);
+    ipl(old_ipl);
+
+    // A wakeup that lands before the switch leaves the thread runnable, so nothing is lost
+    arch_sched_yield();
+    dequeue_self(waitqueue, current);
+
+    if(lock != NULL) spinlock_acquire(lock);
+}
+
+bool waitqueue_wait_unless(waitqueue_t *waitqueue, bool (* condition)(void *data), void *data) {
+    thread_t *current = arch_sched_thread_current();
+
+    ipl_t old_ipl = ipl(IPL_CRITICAL);
+    spinlock_acquire(&waitqueue->lock);
+    // Blocking is announced before the check, whoever makes the condition true after it finds the thread blocking
+    __atomic_store_n(&current->state, THREAD_STATE_BLOCKING, __ATOMIC_SEQ_CST);
+    if(condition(data)) {
+        thread_state_t state = THREAD_STATE_BLOCKING;
+        __atomic_compare_exchange_n(&current->state, &state, THREAD_STATE_ACTIVE, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        spinlock_release(&waitqueue->lock);
+        ipl(old_ipl);
+        return false;
+    }
+    enqueue(waitqueue, current);
+    spinlock_release(&waitqueue->lock);
+    ipl(old_ipl);
+
+    arch_sched_yield();
+    dequeue_self(waitqueue, current);
+    return true;
+}
+
+bool waitqueue_wake_one(waitqueue_t *waitqueue) {
+    ipl_t old_ipl = ipl(IPL_CRITICAL);
+    spinlock_acquire(&waitqueue->lock);
+    thread_t *thread = NULL;
+    if(!list_is_empty(&waitqueue->threads)) {
+        thread = LIST_CONTAINER_GET(LIST_NEXT(&waitqueue->threads), thread_t, list_wait);
+        list_delete(&thread->list_wait);
+        /*
+            A thread woken by something else (see sched_process_exit) may already run and leave once it sees itself dequeued.
+            The wake happens under the lock and the pointer is cleared last, so the thread outlives the wake.
+        */
+        sched_thread_wake(thread);
+        __atomic_store_n(&thread->waitqueue, NULL, __ATOMIC_RELEASE);
+    }
+    spinlock_release(&waitqueue->lock);
+    ipl(old_ipl);
+    return thread != NULL;
+}
+
+size_t waitqueue_wake_all(waitqueue_t *waitqueue) {
+    size_t count = 0;
+    while(waitqueue_wake_one(waitqueue)) count++;
+    return count;
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+#include <stddef.h>
+#include <lib/list.h>
+#include <common/spinlock.h>
+
+#define WAITQUEUE_INIT(NAME) (waitqueue_t) { .lock = {}, .threads = { .next = &(NAME).threads, .prev = &(NAME).threads } }
+
+typedef struct waitqueue {
+    spinlock_t lock;
+    list_t threads;
+} waitqueue_t;
+
+/**
+ * @brief Block the current thread on a wait queue until it is woken
+ * @param lock lock protecting the wait condition, released while blocked and reacquired before returning, may be NULL
+ * @warning The wait condition has to be rechecked after returning, the thread can be woken without it being true
+ */
+void waitqueue_wait(waitqueue_t *waitqueue, spinlock_t *lock);
+
+/**
+ * @brief Block the current thread on a wait queue unless a condition holds
+ * @param condition checked with the wait queue lock held and interrupts masked after the thread is marked as blocking, so a wakeup issued after making it true is never lost
+ * @returns false if the condition held and the thread did not block
+ * @warning The wait condition has to be rechecked after returning
+ */
+bool waitqueue_wait_unless(waitqueue_t *waitqueue, bool (* condition)(void *data), void *data);
+
+/**
+ * @brief Wake the longest waiting thread, safe to call from interrupt context
+ * @returns true if a thread was woken
+ */
+bool waitqueue_wake_one(waitqueue_t *waitqueue);
+
+/**
+ * @brief Wake every thread on a wait queue, safe to call from interrupt context
+ * @returns number of threads woken
+ */
+size_t waitqueue_wake_all(waitqueue_t *waitqueue);
\ No newline at end of file
@@ -0,0 +1,256 @@
+#include "work.h"
+#include <stdint.h>
+#include <lib/mem.h>
+#include <lib/math.h>
+#include <lib/container.h>
+#include <common/spinlock.h>
+#include <common/assert.h>
+#include <memory/heap.h>
+#include <sched/sched.h>
+#include <sched/thread.h>
+#include <sched/waitqueue.h>
+#include <sys/ipl.h>
+#include <arch/sched.h>
+
+#define DEQUE_SIZE 256
+#define PARALLEL_FOR_CHUNKS_PER_CPU 4
+
+/*
+    Chase-Lev work stealing deque. The owning CPU pushes and pops at the bottom, other CPUs steal
+    from the top. Owner operations run with interrupts masked, so work queued from an interrupt
+    never interleaves with the worker popping on the same CPU.
+*/
+typedef struct work_cpu {
+    int64_t top;
+    int64_t bottom;
+    work_t *buffer[DEQUE_SIZE];
+    waitqueue_t waitqueue;
+    thread_t *thread;
+} work_cpu_t;
+
+typedef struct {
+    size_t remaining;
+    int references; // Held by the caller and by the chunk that finishes last
+    waitqueue_t done;
+    void (* func)(size_t index, void *data);
+    void *data;
+} parallel_for_t;
+
+typedef struct {
+    work_t work;
+    parallel_for_t *parallel_for;
+    size_t start;
+    size_t end;
+} parallel_for_chunk_t;
+
+// Work queued while a deque was full or before the CPU had a worker
+static spinlock_t g_overflow_lock = SPINLOCK_INIT;
+static list_t g_overflow = LIST_INIT_CIRCULAR(g_overflow);
+
+/** @warning Owner only */
+static bool deque_push(work_cpu_t *deque, work_t *work) {
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if(bottom - top >= DEQUE_SIZE) return false;
+    __atomic_store_n(&deque->buffer[bottom % DEQUE_SIZE], work, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/** @warning Owner only */
+static work_t *deque_pop(work_cpu_t *deque) {
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    if(top > bottom) {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    work_t *work = __atomic_load_n(&deque->buffer[bottom % DEQUE_SIZE], __ATOMIC_RELAXED);
+    if(top == bottom) {
+        // Last entry, race thieves for it
+        if(!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) work = NULL;
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return work;
+}
+
+static work_t *deque_steal(work_cpu_t *deque) {
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if(top >= bottom) return NULL;
+
+    work_t *work = __atomic_load_n(&deque->buffer[top % DEQUE_SIZE], __ATOMIC_RELAXED);
+    if(!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return NULL;
+    return work;
+}
+
+static bool deque_empty(work_cpu_t *deque) {
+    return __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE) >= __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+}
+
+static bool overflow_empty() {
+    return __atomic_load_n(&g_overflow.next, __ATOMIC_ACQUIRE) == &g_overflow;
+}
+
+static work_t *overflow_pop() {
+    if(overflow_empty()) return NULL;
+    ipl_t old_ipl = ipl(IPL_CRITICAL);
+    spinlock_acquire(&g_overflow_lock);
+    work_t *work = NULL;
+    if(!list_is_empty(&g_overflow)) {
+        work = LIST_CONTAINER_GET(LIST_NEXT(&g_overflow), work_t, list_elem);
+        list_delete(&work->list_elem);
+    }
+    spinlock_release(&g_overflow_lock);
+    ipl(old_ipl);
+    return work;
+}
+
+/** @returns true if the worker was sleeping */
+static bool worker_wake(cpu_t *cpu) {
+    work_cpu_t *worker = __atomic_load_n(&cpu->work, __ATOMIC_ACQUIRE);
+    if(worker == NULL) return false;
+    return waitqueue_wake_one(&worker->waitqueue);
+}
+
+static void worker_wake_all() {
+    cpu_t *cpu;
+    for(size_t i = 0; (cpu = sched_cpu(i)) != NULL; i++) worker_wake(cpu);
+}
+
+/** @returns work from the local deque, another CPU or the overflow list */
+static work_t *work_find() {
+    ipl_t old_ipl = ipl(IPL_CRITICAL);
+    cpu_t *local = cpu_current();
+    work_t *work = local->work != NULL ? deque_pop(local->work) : NULL;
+    ipl(old_ipl);
+    if(work != NULL) return work;
+
+    // OPTIMIZE: steals scan every CPU, starting after the local one to spread thieves out
+    size_t cpu_count = sched_cpu_count();
+    for(size_t i = 1; i < cpu_count; i++) {
+        cpu_t *cpu = sched_cpu((local->id + i) % cpu_count);
+        work_cpu_t *deque = __atomic_load_n(&cpu->work, __ATOMIC_ACQUIRE);
+        if(deque == NULL) continue;
+        work = deque_steal(deque);
+        if(work != NULL) return work;
+    }
+    return overflow_pop();
+}
+
+static bool work_available([[maybe_unused]] void *data) {
+    if(!overflow_empty()) return true;
+    cpu_t *cpu;
+    for(size_t i = 0; (cpu = sched_cpu(i)) != NULL; i++) {
+        work_cpu_t *deque = __atomic_load_n(&cpu->work, __ATOMIC_ACQUIRE);
+        if(deque != NULL && !deque_empty(deque)) return true;
+    }
+    return false;
+}
+
+[[noreturn]] static void worker_thread() {
+    work_cpu_t *worker = cpu_current()->work;
+    while(true) {
+        work_t *work = work_find();
+        if(work != NULL) {
+            work->func(work);
+            continue;
+        }
+        waitqueue_wait_unless(&worker->waitqueue, work_available, NULL);
+    }
+}
+
+void work_cpu_init(cpu_t *cpu) {
+    work_cpu_t *worker = heap_alloc(sizeof(work_cpu_t));
+    memset(worker, 0, sizeof(work_cpu_t));
+    worker->waitqueue = WAITQUEUE_INIT(worker->waitqueue);
+    worker->thread = arch_sched_thread_create_kernel(worker_thread);
+    worker->thread->affinity = (thread_affinity_t) {};
+    worker->thread->affinity.bits[cpu->id / 64] = 1ul << (cpu->id % 64);
+    __atomic_store_n(&cpu->work, worker, __ATOMIC_RELEASE);
+    sched_thread_schedule(worker->thread);
+}
+
+void work_queue(work_t *work) {
+    ipl_t old_ipl = ipl(IPL_CRITICAL);
+    cpu_t *cpu = cpu_current();
+    if(cpu->work == NULL || !deque_push(cpu->work, work)) {
+        spinlock_acquire(&g_overflow_lock);
+        list_prepend(&g_overflow, &work->list_elem);
+        spinlock_release(&g_overflow_lock);
+    }
+    // A busy local worker gets to it eventually, wake another one to steal it meanwhile
+    if(!worker_wake(cpu)) {
+        cpu_t *other;
+        for(size_t i = 0; (other = sched_cpu(i)) != NULL; i++) {
+            if(other != cpu && worker_wake(other)) break;
+        }
+    }
+    ipl(old_ipl);
+}
+
+static void parallel_for_release(parallel_for_t *parallel_for) {
+    if(__atomic_sub_fetch(&parallel_for->references, 1, __ATOMIC_ACQ_REL) == 0) heap_free(parallel_for);
+}
+
+static void parallel_for_run(work_t *work) {
+    parallel_for_chunk_t *chunk = CONTAINER_OF(work, parallel_for_chunk_t, work);
+    parallel_for_t *parallel_for = chunk->parallel_for;
+    for(size_t i = chunk->start; i < chunk->end; i++) parallel_for->func(i, parallel_for->data);
+
+    // The chunk lives in the parallel_for allocation, it must not be touched after this
+    if(__atomic_sub_fetch(&parallel_for->remaining, 1, __ATOMIC_ACQ_REL) != 0) return;
+    waitqueue_wake_all(&parallel_for->done);
+    parallel_for_release(parallel_for);
+}
+
+static bool parallel_for_finished(void *data) {
+    return __atomic_load_n(&((parallel_for_t *) data)->remaining, __ATOMIC_ACQUIRE) == 0;
+}
+
+void work_parallel_for(size_t count, void (* func)(size_t index, void *data), void *data) {
+    if(count == 0) return;
+
+    size_t chunk_count = sched_cpu_count() * PARALLEL_FOR_CHUNKS_PER_CPU;
+    if(chunk_count > count) chunk_count = count;
+    size_t chunk_size = MATH_DIV_CEIL(count, chunk_count);
+    chunk_count = MATH_DIV_CEIL(count, chunk_size);
+
+    parallel_for_t *parallel_for = heap_alloc(sizeof(parallel_for_t) + chunk_count * sizeof(parallel_for_chunk_t));
+    parallel_for->remaining = chunk_count;
+    parallel_for->references = 2;
+    parallel_for->done = WAITQUEUE_INIT(parallel_for->done);
+    parallel_for->func = func;
+    parallel_for->data = data;
+
+    parallel_for_chunk_t *chunks = (parallel_for_chunk_t *) (parallel_for + 1);
+    ipl_t old_ipl = ipl(IPL_CRITICAL);
+    cpu_t *cpu = cpu_current();
+    for(size_t i = 0; i < chunk_count; i++) {
+        chunks[i].work = WORK_INIT(parallel_for_run);
+        chunks[i].parallel_for = parallel_for;
+        chunks[i].start = i * chunk_size;
+        chunks[i].end = (i + 1) * chunk_size < count ? (i + 1) * chunk_size : count;
+        if(cpu->work != NULL && deque_push(cpu->work, &chunks[i].work)) continue;
+        spinlock_acquire(&g_overflow_lock);
+        list_prepend(&g_overflow, &chunks[i].work.list_elem);
+        spinlock_release(&g_overflow_lock);
+    }
+    ipl(old_ipl);
+    worker_wake_all();
+
+    // Help instead of only blocking, a worker calling this would otherwise wait on work queued behind itself
+    while(!parallel_for_finished(parallel_for)) {
+        work_t *work = work_find();
+        if(work != NULL) {
+            work->func(work);
+            continue;
+        }
+        waitqueue_wait_unless(&parallel_for->done, parallel_for_finished, parallel_for);
+    }
+    parallel_for_release(parallel_for);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <stddef.h>
+#include <lib/list.h>
+
+struct cpu;
+
+#define WORK_INIT(FUNC) (work_t) { .func = (FUNC), .list_elem = LIST_INIT }
+
+typedef struct work {
+    void (* func)(struct work *work);
+    list_element_t list_elem; // Only used while the work sits on the overflow list
+} work_t;
+
+/**
+ * @brief Create the worker thread of a CPU, pinned to that CPU
+ * @warning The CPU has to be registered with the scheduler
+ */
+void work_cpu_init(struct cpu *cpu);
+
+/**
+ * @brief Queue caller owned work on the current CPU, it runs once on a worker thread (of any CPU that steals it)
+ * @warning Safe to call from interrupt context once the scheduler runs. Work must not be queued again before it ran
+ */
+void work_queue(work_t *work);
+
+/**
+ * @brief Run func for every index in [0, count) spread over all workers, returns when every call returned
+ * @note The caller runs queued work while it waits, which can include unrelated work
+ * @warning Not safe to call from interrupt context
+ */
+void work_parallel_for(size_t count, void (* func)(size_t index, void *data), void *data);
@@ -1,8 +1,36 @@
 #pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <lib/list.h>
+#include <common/spinlock.h>
 #include <sched/thread.h>
+#include <sched/stats.h>
 
 typedef struct cpu {
+    size_t id; // Assigned when registering with the scheduler
+    uint32_t cache_domain; // CPUs sharing a last level cache share a domain, set before registering
     struct thread *idle_thread;
+    struct work_cpu *work; // Worker of this CPU, see sched/work.h
+    uint64_t rcu_generation; // RCU generation this CPU last passed a quiescent state in, see sched/rcu.h
+    struct {
+        spinlock_t lock;
+        list_t queue;
+        list_t idle_queue;
+        size_t count;
+        uint64_t weight;
+        uint64_t min_vruntime;
+        bool idle; // CPU is running its idle thread
+        bool tickless; // Scheduler timer is stopped, enqueues and the balance timer have to preempt the CPU
+        uint64_t load_avg; // Decaying average of the runnable weight, updated every balance interval
+        uint64_t load_update; // Time the load average was last updated
+    } run_queue;
+    struct {
+        sched_histogram_t latency; // Nanoseconds from being queued to running
+        sched_histogram_t slice; // Nanoseconds a thread ran before switching away
+        uint64_t voluntary;
+        uint64_t involuntary;
+        uint64_t migrations;
+    } stats; // Only written by the CPU itself
 } cpu_t;
 
 /**
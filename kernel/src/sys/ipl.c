@@ -1,8 +1,11 @@
 #include "ipl.h"
+#include <sched/preempt.h>
 #include <arch/interrupt.h>
 
 ipl_t ipl(ipl_t ipl) {
     ipl_t old = arch_interrupt_get_ipl();
     arch_interrupt_set_ipl(ipl);
+    // A scheduler interrupt deferred while the IPL was raised can be handled now
+    if(ipl == IPL_SCHED && old != IPL_SCHED) preempt_check();
     return old;
 }
\ No newline at end of file
@@ -9,7 +9,7 @@ static spinlock_t g_lock = SPINLOCK_INIT;
 static list_t g_timers = LIST_INIT; // TODO: this needs to be a vector instead of a list (cuz linked list is def too slow here)
 
 void time_advance(time_t length) {
-    spinlock_acquire(&g_lock);
+    ipl_t old_ipl = spinlock_acquire_irqsave(&g_lock);
 
     g_time_monotonic = time_add(g_time_monotonic, length);
     g_time_realtime = time_add(g_time_realtime, length);
@@ -18,19 +18,53 @@ void time_advance(time_t length) {
         timer_t *timer = LIST_CONTAINER_GET(elem, timer_t, list_elem);
         if(timer->deadline.seconds > g_time_monotonic.seconds) continue;
         if(timer->deadline.seconds == g_time_monotonic.seconds && timer->deadline.nanoseconds > g_time_monotonic.nanoseconds) continue;
+        if(timer->period.seconds != 0 || timer->period.nanoseconds != 0) {
+            timer->deadline = time_add(timer->deadline, timer->period);
+            timer->callback(timer);
+            continue;
+        }
         list_delete(&timer->list_elem);
+        timer->armed = false;
         timer->callback(timer);
     }
 
-    spinlock_release(&g_lock);
+    spinlock_release_irqrestore(&g_lock, old_ipl);
 }
 
 timer_t *timer_create(time_t length, void (* callback)(timer_t *timer)) {
     timer_t *timer = heap_alloc(sizeof(timer_t));
+    timer_arm(timer, length, callback);
+    return timer;
+}
+
+void timer_arm(timer_t *timer, time_t length, void (* callback)(timer_t *timer)) {
     timer->callback = callback;
-    spinlock_acquire(&g_lock);
+    timer->period = (time_t) {};
+    // The lock is shared with the timer interrupt
+    ipl_t old_ipl = spinlock_acquire_irqsave(&g_lock);
     timer->deadline = time_add(g_time_monotonic, length);
+    timer->armed = true;
     list_append(&g_timers, &timer->list_elem);
-    spinlock_release(&g_lock);
-    return timer;
+    spinlock_release_irqrestore(&g_lock, old_ipl);
+}
+
+void timer_arm_periodic(timer_t *timer, time_t period, void (* callback)(timer_t *timer)) {
+    timer->callback = callback;
+    timer->period = period;
+    ipl_t old_ipl = spinlock_acquire_irqsave(&g_lock);
+    timer->deadline = time_add(g_time_monotonic, period);
+    timer->armed = true;
+    list_append(&g_timers, &timer->list_elem);
+    spinlock_release_irqrestore(&g_lock, old_ipl);
+}
+
+bool timer_disarm(timer_t *timer) {
+    ipl_t old_ipl = spinlock_acquire_irqsave(&g_lock);
+    bool armed = timer->armed;
+    if(armed) {
+        list_delete(&timer->list_elem);
+        timer->armed = false;
+    }
+    spinlock_release_irqrestore(&g_lock, old_ipl);
+    return armed;
 }
\ No newline at end of file
@@ -11,6 +11,8 @@ typedef struct {
 
 typedef struct timer {
     time_t deadline;
+    time_t period; // Zero for one-shot timers
+    bool armed;
     void (* callback)(struct timer *timer);
     list_element_t list_elem;
 } timer_t;
@@ -55,6 +57,13 @@ static inline time_t time_subtract(time_t a, time_t b) {
     return a;
 }
 
+/**
+ * @brief Convert a time to nanoseconds
+ */
+static inline uint64_t time_nanoseconds(time_t time) {
+    return time.seconds * TIME_NANOSECONDS_IN_SECOND + time.nanoseconds;
+}
+
 /**
  * @brief Advance time by some length
  */
@@ -63,4 +72,22 @@ void time_advance(time_t length);
 /**
  * @brief Create timer
  */
-timer_t *timer_create(time_t length, void (* callback)(timer_t *timer));
\ No newline at end of file
+timer_t *timer_create(time_t length, void (* callback)(timer_t *timer));
+
+/**
+ * @brief Arm a caller owned timer
+ * @warning The callback runs in interrupt context
+ */
+void timer_arm(timer_t *timer, time_t length, void (* callback)(timer_t *timer));
+
+/**
+ * @brief Arm a caller owned timer that fires every period until disarmed
+ * @warning The callback runs in interrupt context and must not arm timers itself
+ */
+void timer_arm_periodic(timer_t *timer, time_t period, void (* callback)(timer_t *timer));
+
+/**
+ * @brief Disarm a timer, if its callback is running this waits for it to finish
+ * @returns true if the timer was still pending
+ */
+bool timer_disarm(timer_t *timer);
\ No newline at end of file
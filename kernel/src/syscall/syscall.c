@@ -7,16 +7,25 @@
 #include <memory/vmm.h>
 #include <memory/heap.h>
 #include <arch/sched.h>
+#include <arch/uaccess.h>
+
+static bool in_userspace(void *address, size_t count) {
+    vmm_address_space_t *address_space = arch_sched_thread_current()->proc->address_space;
+    uintptr_t start = (uintptr_t) address;
+    return start >= address_space->start && start < address_space->end && address_space->end - start >= count;
+}
 
 int syscall_buffer_out(void *dest, void *src, size_t count) {
     ASSERT(arch_sched_thread_current()->proc != NULL);
-    return vmm_copy_to(arch_sched_thread_current()->proc->address_space, (uintptr_t) dest, src, count);
+    if(!in_userspace(dest, count)) return 0;
+    return arch_uaccess_copy_to(dest, src, count);
 }
 
 void *syscall_buffer_in(void *src, size_t count) {
     ASSERT(arch_sched_thread_current()->proc != NULL);
+    if(!in_userspace(src, count)) return NULL;
     void *buffer = heap_alloc(count);
-    size_t read_count = vmm_copy_from(buffer, arch_sched_thread_current()->proc->address_space, (uintptr_t) src, count);
+    size_t read_count = arch_uaccess_copy_from(buffer, src, count);
     if(read_count != count) {
         heap_free(buffer);
         return NULL;
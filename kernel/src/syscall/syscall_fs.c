@@ -10,6 +10,7 @@
 #include <common/log.h>
 #include <syscall/syscall.h>
 #include <memory/heap.h>
+#include <fs/page_cache.h>
 #include <arch/types.h>
 #include <arch/sched.h>
 
@@ -99,6 +100,7 @@ syscall_return_t syscall_fs_open(int dir_resource_id, size_t path_length, char *
             ret.err = -r;
             return ret;
         }
+        page_cache_truncate(node, 0);
     }
 
     size_t offset = 0;
@@ -145,6 +147,7 @@ syscall_return_t syscall_fs_read(int resource_id, void *buf, size_t count) {
         .size = count,
         .offset = resource->offset
     }, &read_count);
+    page_cache_read(resource->node, resource->offset, read_count, read_buf);
     syscall_buffer_out(buf, read_buf, read_count);
     heap_free(read_buf);
     resource->offset += read_count;
@@ -177,6 +180,7 @@ syscall_return_t syscall_fs_write(int resource_id, void *buf, size_t count) {
         .size = count,
         .offset = resource->offset
     }, &write_count);
+    page_cache_write(resource->node, resource->offset, write_count, buf);
     heap_free(buf);
     resource->offset += write_count;
     ret.value = write_count;
@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <errno.h>
+#include <common/log.h>
+#include <memory/heap.h>
+#include <syscall/syscall.h>
+#include <sched/futex.h>
+#include <sys/time.h>
+#include <arch/sched.h>
+
+#define FUTEX_VALID(ADDRESS_SPACE, ADDRESS) ((uintptr_t) (ADDRESS) % sizeof(int) == 0 && (uintptr_t) (ADDRESS) >= (ADDRESS_SPACE)->start && (uintptr_t) (ADDRESS) + sizeof(int) <= (ADDRESS_SPACE)->end)
+
+syscall_return_t syscall_futex_wait(int *address, int expected, syscall_timeout_t *timeout) {
+    syscall_return_t ret = {};
+    vmm_address_space_t *address_space = arch_sched_thread_current()->proc->address_space;
+    if(!FUTEX_VALID(address_space, address)) {
+        ret.err = EINVAL;
+        return ret;
+    }
+
+    time_t length;
+    if(timeout != NULL) {
+        syscall_timeout_t *user_timeout = syscall_buffer_in(timeout, sizeof(syscall_timeout_t));
+        if(user_timeout == NULL) {
+            ret.err = EFAULT;
+            return ret;
+        }
+        length = (time_t) { .seconds = user_timeout->seconds, .nanoseconds = user_timeout->nanoseconds };
+        heap_free(user_timeout);
+        if(length.nanoseconds >= TIME_NANOSECONDS_IN_SECOND) {
+            ret.err = EINVAL;
+            return ret;
+        }
+    }
+
+    int r = futex_wait(address_space, address, expected, timeout != NULL ? &length : NULL);
+    if(r < 0) ret.err = -r;
+    return ret;
+}
+
+syscall_return_t syscall_futex_wake(int *address, size_t count) {
+    syscall_return_t ret = {};
+    vmm_address_space_t *address_space = arch_sched_thread_current()->proc->address_space;
+    if(!FUTEX_VALID(address_space, address)) {
+        ret.err = EINVAL;
+        return ret;
+    }
+    ret.value = futex_wake(address_space, address, count);
+    return ret;
+}
+
+syscall_return_t syscall_futex_requeue(int *address, int expected, size_t wake_count, int *target, size_t requeue_count) {
+    syscall_return_t ret = {};
+    vmm_address_space_t *address_space = arch_sched_thread_current()->proc->address_space;
+    if(!FUTEX_VALID(address_space, address) || !FUTEX_VALID(address_space, target)) {
+        ret.err = EINVAL;
+        return ret;
+    }
+
+    long r = futex_requeue(address_space, address, expected, wake_count, target, requeue_count);
+    if(r < 0) {
+        ret.err = -r;
+        return ret;
+    }
+    log(LOG_LEVEL_DEBUG, "SYSCALL", "futex_requeue(address: %#lx, target: %#lx) -> %li", (uintptr_t) address, (uintptr_t) target, r);
+    ret.value = r;
+    return ret;
+}
\ No newline at end of file
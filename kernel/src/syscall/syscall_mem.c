@@ -1,20 +1,35 @@
 #include <stdint.h>
 #include <errno.h>
+#include <sys/mman.h>
 #include <common/log.h>
 #include <lib/mem.h>
 #include <syscall/syscall.h>
 #include <memory/vmm.h>
+#include <sched/resource.h>
 #include <arch/types.h>
 #include <arch/sched.h>
 
+#define REGION_IN_ADDRESS_SPACE(ADDRESS_SPACE, ADDRESS, LENGTH) ((ADDRESS) >= (ADDRESS_SPACE)->start && (ADDRESS) < (ADDRESS_SPACE)->end && (ADDRESS_SPACE)->end - (ADDRESS) >= (LENGTH))
+
+static vmm_protection_t prot_to_vmm(int prot) {
+    vmm_protection_t vmm_prot = VMM_PROT_NONE;
+    if((prot & PROT_WRITE) != 0) vmm_prot |= VMM_PROT_WRITE;
+    if((prot & PROT_EXEC) != 0) vmm_prot |= VMM_PROT_EXEC;
+    if((prot & PROT_READ) != 0 || vmm_prot != VMM_PROT_NONE) vmm_prot |= VMM_PROT_READ; // Write and execute imply read
+    return vmm_prot;
+}
+
 syscall_return_t syscall_mem_anon_allocate(uintptr_t size) {
     syscall_return_t ret = {};
     if(size == 0 || size % ARCH_PAGE_SIZE != 0) {
         ret.err = EINVAL;
         return ret;
     }
-    void *p = vmm_map_anon(arch_sched_thread_current()->proc->address_space, NULL, size, VMM_PROT_READ | VMM_PROT_WRITE, VMM_FLAG_NONE, VMM_CACHE_STANDARD);
-    memset(p, 0, size);
+    void *p = vmm_map_anon(arch_sched_thread_current()->proc->address_space, NULL, size, VMM_PROT_READ | VMM_PROT_WRITE, VMM_CACHE_STANDARD, VMM_FLAG_ANON_ZERO);
+    if(p == NULL) {
+        ret.err = ENOMEM;
+        return ret;
+    }
     ret.value = (uintptr_t) p;
     log(LOG_LEVEL_DEBUG, "SYSCALL", "anon_alloc(size: %#lx) -> %#lx", size, ret.value);
     return ret;
@@ -34,3 +49,112 @@ syscall_return_t syscall_mem_anon_free(void *pointer, size_t size) {
     log(LOG_LEVEL_DEBUG, "SYSCALL", "anon_free(ptr: %#lx, size: %#lx)", (uint64_t) pointer, size);
     return ret;
 }
+
+
+syscall_return_t syscall_mem_map(void *hint, size_t length, int prot, int flags, int resource_id, off_t offset) {
+    syscall_return_t ret = {};
+    log(LOG_LEVEL_DEBUG, "SYSCALL", "vm_map(hint: %#lx, length: %#lx, prot: %i, flags: %i, resource_id: %i, offset: %#lx)", (uintptr_t) hint, length, prot, flags, resource_id, offset);
+
+    if((flags & ~(MAP_SHARED | MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS)) != 0) {
+        log(LOG_LEVEL_ERROR, "SYSCALL", "Unsupported vm_map flags: %i", flags);
+        ret.err = ENOTSUP;
+        return ret;
+    }
+
+    if(length == 0 || length % ARCH_PAGE_SIZE != 0 || ((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0)) {
+        ret.err = EINVAL;
+        return ret;
+    }
+
+    // Anonymous segments have no backing object that a forked child could share
+    if((flags & (MAP_SHARED | MAP_ANONYMOUS)) == (MAP_SHARED | MAP_ANONYMOUS)) {
+        ret.err = ENOTSUP;
+        return ret;
+    }
+
+    process_t *proc = arch_sched_thread_current()->proc;
+
+    vmm_protection_t vmm_prot = prot_to_vmm(prot);
+    vmm_flags_t vmm_flags = VMM_FLAG_NONE;
+    if((flags & MAP_FIXED) != 0) {
+        if((uintptr_t) hint % ARCH_PAGE_SIZE != 0 || !REGION_IN_ADDRESS_SPACE(proc->address_space, (uintptr_t) hint, length)) {
+            ret.err = EINVAL;
+            return ret;
+        }
+        // The old mappings are only replaced once everything is validated, within the same lock hold as the new mapping
+        vmm_flags |= VMM_FLAG_FIXED | VMM_FLAG_REPLACE;
+    }
+
+    resource_t *resource = NULL;
+    if((flags & MAP_ANONYMOUS) == 0) {
+        resource = resource_get(&proc->resource_table, resource_id);
+        if(resource == NULL || resource->mode == RESOURCE_MODE_REFERENCE) {
+            ret.err = EBADF;
+            return ret;
+        }
+        if(resource->node->type != VFS_NODE_TYPE_FILE) {
+            ret.err = ENODEV;
+            return ret;
+        }
+        if(
+            resource->mode == RESOURCE_MODE_WRITE_ONLY ||
+            ((flags & MAP_SHARED) != 0 && (prot & PROT_WRITE) != 0 && resource->mode != RESOURCE_MODE_READ_WRITE)
+        ) {
+            ret.err = EACCES;
+            return ret;
+        }
+        if(offset < 0 || offset % ARCH_PAGE_SIZE != 0) {
+            ret.err = EINVAL;
+            return ret;
+        }
+        if((flags & MAP_SHARED) != 0) vmm_flags |= VMM_FLAG_SHARED;
+    }
+
+    void *address;
+    if(resource == NULL) {
+        address = vmm_map_anon(proc->address_space, hint, length, vmm_prot, VMM_CACHE_STANDARD, vmm_flags | VMM_FLAG_ANON_ZERO);
+    } else {
+        address = vmm_map_file(proc->address_space, hint, length, vmm_prot, vmm_flags, resource->node, (size_t) offset);
+    }
+
+    if(address == NULL) {
+        ret.err = ENOMEM;
+        return ret;
+    }
+    ret.value = (uintptr_t) address;
+    log(LOG_LEVEL_DEBUG, "SYSCALL", "vm_map -> %#lx", ret.value);
+    return ret;
+}
+
+syscall_return_t syscall_mem_unmap(void *pointer, size_t length) {
+    syscall_return_t ret = {};
+    log(LOG_LEVEL_DEBUG, "SYSCALL", "vm_unmap(ptr: %#lx, length: %#lx)", (uintptr_t) pointer, length);
+
+    process_t *proc = arch_sched_thread_current()->proc;
+    if(
+        length == 0 || length % ARCH_PAGE_SIZE != 0 || ((uintptr_t) pointer) % ARCH_PAGE_SIZE != 0 ||
+        !REGION_IN_ADDRESS_SPACE(proc->address_space, (uintptr_t) pointer, length)
+    ) {
+        ret.err = EINVAL;
+        return ret;
+    }
+    vmm_unmap(proc->address_space, pointer, length);
+    return ret;
+}
+
+syscall_return_t syscall_mem_protect(void *pointer, size_t length, int prot) {
+    syscall_return_t ret = {};
+    log(LOG_LEVEL_DEBUG, "SYSCALL", "vm_protect(ptr: %#lx, length: %#lx, prot: %i)", (uintptr_t) pointer, length, prot);
+
+    process_t *proc = arch_sched_thread_current()->proc;
+    if(
+        length == 0 || length % ARCH_PAGE_SIZE != 0 || ((uintptr_t) pointer) % ARCH_PAGE_SIZE != 0 ||
+        (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0 ||
+        !REGION_IN_ADDRESS_SPACE(proc->address_space, (uintptr_t) pointer, length)
+    ) {
+        ret.err = EINVAL;
+        return ret;
+    }
+    if(!vmm_protect(proc->address_space, pointer, length, prot_to_vmm(prot))) ret.err = ENOMEM;
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include <stdint.h>
+#include <errno.h>
+#include <lib/mem.h>
+#include <common/log.h>
+#include <memory/heap.h>
+#include <syscall/syscall.h>
+#include <memory/vmm.h>
+#include <sched/sched.h>
+#include <sched/process.h>
+#include <sched/resource.h>
+#include <arch/sched.h>
+
+syscall_return_t syscall_proc_fork() {
+    syscall_return_t ret = {};
+    process_t *proc = arch_sched_thread_current()->proc;
+
+    process_t *child = sched_process_create(vmm_fork(proc->address_space));
+    child->cwd = proc->cwd;
+    resource_table_copy(&child->resource_table, &proc->resource_table);
+
+    sched_thread_schedule(arch_sched_thread_fork(child));
+
+    ret.value = child->id;
+    log(LOG_LEVEL_DEBUG, "SYSCALL", "fork() -> %li", child->id);
+    return ret;
+}
+
+syscall_return_t syscall_proc_set_priority(int policy, int nice) {
+    syscall_return_t ret = {};
+
+    thread_policy_t thread_policy;
+    switch(policy) {
+        case SYSCALL_SCHED_POLICY_NORMAL: thread_policy = THREAD_POLICY_NORMAL; break;
+        case SYSCALL_SCHED_POLICY_IDLE: thread_policy = THREAD_POLICY_IDLE; break;
+        default:
+            ret.err = EINVAL;
+            return ret;
+    }
+
+    // Clamp like setpriority(2) does for out of range values
+    if(nice < SCHED_NICE_MIN) nice = SCHED_NICE_MIN;
+    if(nice > SCHED_NICE_MAX) nice = SCHED_NICE_MAX;
+
+    sched_thread_set_priority(arch_sched_thread_current(), thread_policy, nice);
+    log(LOG_LEVEL_DEBUG, "SYSCALL", "set_priority(policy: %i, nice: %i)", policy, nice);
+    return ret;
+}
+
+/** @warning Assumes the process lock is acquired */
+static thread_t *process_thread(process_t *proc, long tid) {
+    LIST_FOREACH(&proc->threads, elem) {
+        thread_t *thread = LIST_CONTAINER_GET(elem, thread_t, list_proc);
+        if(thread->id == tid) return thread;
+    }
+    return NULL;
+}
+
+syscall_return_t syscall_proc_set_affinity(long tid, size_t size, void *mask) {
+    syscall_return_t ret = {};
+    if(size == 0) {
+        ret.err = EINVAL;
+        return ret;
+    }
+
+    // Bits beyond the supported CPUs are ignored, missing bits are clear
+    thread_affinity_t affinity = {};
+    size_t copy_size = size < sizeof(thread_affinity_t) ? size : sizeof(thread_affinity_t);
+    void *user_mask = syscall_buffer_in(mask, copy_size);
+    if(user_mask == NULL) {
+        ret.err = EFAULT;
+        return ret;
+    }
+    memcpy(&affinity, user_mask, copy_size);
+    heap_free(user_mask);
+
+    thread_t *current = arch_sched_thread_current();
+    if(tid == 0 || tid == current->id) {
+        if(!sched_thread_set_affinity(current, &affinity)) ret.err = EINVAL;
+    } else {
+        spinlock_acquire(&current->proc->lock);
+        thread_t *thread = process_thread(current->proc, tid);
+        if(thread == NULL) {
+            ret.err = ESRCH;
+        } else if(!sched_thread_set_affinity(thread, &affinity)) {
+            ret.err = EINVAL;
+        }
+        spinlock_release(&current->proc->lock);
+    }
+    log(LOG_LEVEL_DEBUG, "SYSCALL", "set_affinity(tid: %li, size: %lu, mask: %#lx) -> %lu", tid, size, affinity.bits[0], ret.err);
+    return ret;
+}
+
+syscall_return_t syscall_proc_get_affinity(long tid, size_t size, void *mask) {
+    syscall_return_t ret = {};
+    if(size == 0) {
+        ret.err = EINVAL;
+        return ret;
+    }
+
+    thread_affinity_t affinity;
+    thread_t *current = arch_sched_thread_current();
+    if(tid == 0 || tid == current->id) {
+        sched_thread_get_affinity(current, &affinity);
+    } else {
+        spinlock_acquire(&current->proc->lock);
+        thread_t *thread = process_thread(current->proc, tid);
+        if(thread != NULL) sched_thread_get_affinity(thread, &affinity);
+        spinlock_release(&current->proc->lock);
+        if(thread == NULL) {
+            ret.err = ESRCH;
+            return ret;
+        }
+    }
+
+    size_t copy_size = size < sizeof(thread_affinity_t) ? size : sizeof(thread_affinity_t);
+    if(syscall_buffer_out(mask, &affinity, copy_size) != (int) copy_size) {
+        ret.err = EFAULT;
+        return ret;
+    }
+    ret.value = copy_size;
+    log(LOG_LEVEL_DEBUG, "SYSCALL", "get_affinity(tid: %li, size: %lu) -> %#lx", tid, size, affinity.bits[0]);
+    return ret;
+}
+
+syscall_return_t syscall_proc_rusage(int scope, syscall_rusage_t *usage) {
+    syscall_return_t ret = {};
+
+    syscall_rusage_t rusage = {};
+    thread_t *current = arch_sched_thread_current();
+    switch(scope) {
+        case SYSCALL_RUSAGE_SCOPE_PROCESS: sched_process_cputime(current->proc, &rusage.user_time, &rusage.system_time); break;
+        case SYSCALL_RUSAGE_SCOPE_THREAD: sched_thread_cputime(current, &rusage.user_time, &rusage.system_time); break;
+        default:
+            ret.err = EINVAL;
+            return ret;
+    }
+
+    if(syscall_buffer_out(usage, &rusage, sizeof(syscall_rusage_t)) != sizeof(syscall_rusage_t)) {
+        ret.err = EFAULT;
+        return ret;
+    }
+    log(LOG_LEVEL_DEBUG, "SYSCALL", "rusage(scope: %i) -> user: %lu, system: %lu", scope, rusage.user_time, rusage.system_time);
+    return ret;
+}
+
+syscall_return_t syscall_proc_thread_create(uintptr_t entry, uintptr_t stack, uintptr_t tls) {
+    syscall_return_t ret = {};
+    thread_t *current = arch_sched_thread_current();
+    vmm_address_space_t *address_space = current->proc->address_space;
+    if(entry < address_space->start || entry >= address_space->end || stack < address_space->start || stack > address_space->end) {
+        ret.err = EINVAL;
+        return ret;
+    }
+
+    thread_t *thread = arch_sched_thread_create_user(current->proc, entry, stack, tls);
+    sched_thread_set_priority(thread, current->policy, current->nice);
+    thread->affinity = current->affinity;
+    sched_thread_schedule(thread);
+
+    ret.value = thread->id;
+    log(LOG_LEVEL_DEBUG, "SYSCALL", "thread_create(entry: %#lx, stack: %#lx, tls: %#lx) -> %li", entry, stack, tls, thread->id);
+    return ret;
+}
+
+[[noreturn]] void syscall_proc_thread_exit() {
+    thread_t *current = arch_sched_thread_current();
+    log(LOG_LEVEL_DEBUG, "SYSCALL", "thread_exit(tid: %li)", current->id);
+    current->state = THREAD_STATE_DESTROY;
+    arch_sched_yield();
+    __builtin_unreachable();
+}
\ No newline at end of file
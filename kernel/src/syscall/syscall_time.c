@@ -2,7 +2,9 @@
 #include <errno.h>
 #include <common/log.h>
 #include <syscall/syscall.h>
+#include <sched/sched.h>
 #include <sys/time.h>
+#include <arch/sched.h>
 
 syscall_return_t syscall_time_clock(int clock, int mode, uint64_t *seconds, uint32_t *nanoseconds) {
     syscall_return_t ret = {};
@@ -33,6 +35,23 @@ syscall_return_t syscall_time_clock(int clock, int mode, uint64_t *seconds, uint
                 case SYSCALL_CLOCK_MODE_GET: time = g_time_monotonic; break;
             }
             break;
+        case SYSCALL_CLOCK_TYPE_PROCESS_CPUTIME:
+        case SYSCALL_CLOCK_TYPE_THREAD_CPUTIME:
+            switch(mode) {
+                case SYSCALL_CLOCK_MODE_RES: time = (time_t) { .nanoseconds = 1 }; break;
+                case SYSCALL_CLOCK_MODE_GET: {
+                    uint64_t user_time, system_time;
+                    thread_t *current = arch_sched_thread_current();
+                    if(clock == SYSCALL_CLOCK_TYPE_PROCESS_CPUTIME) {
+                        sched_process_cputime(current->proc, &user_time, &system_time);
+                    } else {
+                        sched_thread_cputime(current, &user_time, &system_time);
+                    }
+                    uint64_t cputime = user_time + system_time;
+                    time = (time_t) { .seconds = cputime / TIME_NANOSECONDS_IN_SECOND, .nanoseconds = cputime % TIME_NANOSECONDS_IN_SECOND };
+                } break;
+            }
+            break;
         default:
             ret.err = EINVAL;
             return ret;
@@ -2,7 +2,10 @@
 #include <stdint.h>
 #include <string.h>
 #include <errno.h>
+#include <cpuid.h>
 #include <fcntl.h>
+#include <sched.h>
+#include <sys/resource.h>
 #include <bits/ensure.h>
 #include <mlibc/debug.hpp>
 #include <mlibc/all-sysdeps.hpp>
@@ -25,19 +28,27 @@ namespace mlibc {
     }
 
     int sys_tcb_set(void *pointer) {
+        // The kernel enables CR4.FSGSBASE whenever CPUID reports it (also published as AT_HWCAP2 bit 1)
+        static int fsgsbase = -1;
+        if(fsgsbase < 0) {
+            unsigned int eax, ebx, ecx, edx;
+            fsgsbase = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & 1);
+        }
+        if(fsgsbase) {
+            asm volatile("wrfsbase %0" : : "r" (pointer) : "memory");
+            return 0;
+        }
         return syscall1(SYSCALL_FS_SET, (syscall_int_t) pointer).err;
     }
 
-    int sys_futex_wait(int *pointer [[maybe_unused]], int expected [[maybe_unused]], const struct timespec *time [[maybe_unused]]) {
-        // TODO: Implement
-        mlibc::infoLogger() << "unimplemented sys_futex_wait called" << frg::endlog;
-        return -1;
+    int sys_futex_wait(int *pointer, int expected, const struct timespec *time) {
+        if(time == NULL) return syscall3(SYSCALL_FUTEX_WAIT, (syscall_int_t) pointer, (syscall_int_t) expected, 0).err;
+        syscall_timeout_t timeout = { .seconds = (uint64_t) time->tv_sec, .nanoseconds = (uint32_t) time->tv_nsec };
+        return syscall3(SYSCALL_FUTEX_WAIT, (syscall_int_t) pointer, (syscall_int_t) expected, (syscall_int_t) &timeout).err;
     }
 
-    int sys_futex_wake(int *pointer [[maybe_unused]]) {
-        // TODO: Implement
-        mlibc::infoLogger() << "unimplemented sys_futex_wake called" << frg::endlog;
-        return -1;
+    int sys_futex_wake(int *pointer) {
+        return syscall2(SYSCALL_FUTEX_WAKE, (syscall_int_t) pointer, (syscall_int_t) INT32_MAX).err;
     }
 
     int sys_anon_allocate(size_t size, void **pointer) {
@@ -105,22 +116,19 @@ namespace mlibc {
     }
 
     // mlibc assumes that anonymous memory returned by sys_vm_map() is zeroed by the kernel / whatever is behind the sysdeps
-    int sys_vm_map(void *hint [[maybe_unused]], size_t size [[maybe_unused]], int prot [[maybe_unused]], int flags [[maybe_unused]], int fd [[maybe_unused]], off_t offset [[maybe_unused]], void **window [[maybe_unused]]) {
-        // TODO: Implement
-        mlibc::infoLogger() << "unimplemented sys_vm_map called" << frg::endlog;
-        return -1;
+    int sys_vm_map(void *hint, size_t size, int prot, int flags, int fd, off_t offset, void **window) {
+        syscall_return_t ret = syscall6(SYSCALL_VM_MAP, (syscall_int_t) hint, size, (syscall_int_t) prot, (syscall_int_t) flags, (syscall_int_t) fd, (syscall_int_t) offset);
+        if(ret.err != 0) return ret.err;
+        *window = (void *) ret.value;
+        return 0;
     }
 
-    int sys_vm_unmap(void *pointer [[maybe_unused]], size_t size [[maybe_unused]]) {
-        // TODO: Implement
-        mlibc::infoLogger() << "unimplemented sys_vm_unmap called" << frg::endlog;
-        return -1;
+    int sys_vm_unmap(void *pointer, size_t size) {
+        return syscall2(SYSCALL_VM_UNMAP, (syscall_int_t) pointer, size).err;
     }
 
-    int sys_vm_protect(void *pointer [[maybe_unused]], size_t size [[maybe_unused]], int prot [[maybe_unused]]) {
-        // TODO: Implement
-        mlibc::infoLogger() << "unimplemented sys_vm_protect called" << frg::endlog;
-        return -1;
+    int sys_vm_protect(void *pointer, size_t size, int prot) {
+        return syscall3(SYSCALL_VM_PROTECT, (syscall_int_t) pointer, size, (syscall_int_t) prot).err;
     }
 
     static int clock_get(int clock, syscall_clock_mode_t mode, time_t *secs, long *nanos) {
@@ -136,6 +144,12 @@ namespace mlibc {
             case CLOCK_MONOTONIC_COARSE:
                 type = SYSCALL_CLOCK_TYPE_MONOTONIC;
                 break;
+            case CLOCK_PROCESS_CPUTIME_ID:
+                type = SYSCALL_CLOCK_TYPE_PROCESS_CPUTIME;
+                break;
+            case CLOCK_THREAD_CPUTIME_ID:
+                type = SYSCALL_CLOCK_TYPE_THREAD_CPUTIME;
+                break;
             default: return EINVAL;
         }
 
@@ -169,4 +183,47 @@ namespace mlibc {
         return syscall2(SYSCALL_FS_GETCWD, (syscall_int_t) size, (syscall_int_t) buffer).err;
     }
 
+    int sys_fork(pid_t *child) {
+        syscall_return_t ret = syscall0(SYSCALL_FORK);
+        if(ret.err != 0) return ret.err;
+        *child = (pid_t) ret.value;
+        return 0;
+    }
+
+    int sys_setpriority(int which, id_t who, int prio) {
+        if(which != PRIO_PROCESS || who != 0) return EINVAL;
+        return syscall2(SYSCALL_SET_PRIORITY, (syscall_int_t) SYSCALL_SCHED_POLICY_NORMAL, (syscall_int_t) prio).err;
+    }
+
+    int sys_getrusage(int scope, struct rusage *usage) {
+        memset(usage, 0, sizeof(struct rusage));
+
+        syscall_rusage_scope_t type;
+        switch(scope) {
+            case RUSAGE_SELF: type = SYSCALL_RUSAGE_SCOPE_PROCESS; break;
+            case RUSAGE_THREAD: type = SYSCALL_RUSAGE_SCOPE_THREAD; break;
+            case RUSAGE_CHILDREN: return 0; // Children are never waited for, so none have been accounted
+            default: return EINVAL;
+        }
+
+        syscall_rusage_t rusage;
+        syscall_return_t ret = syscall2(SYSCALL_RUSAGE, (syscall_int_t) type, (syscall_int_t) &rusage);
+        if(ret.err != 0) return ret.err;
+        usage->ru_utime.tv_sec = (time_t) (rusage.user_time / 1'000'000'000);
+        usage->ru_utime.tv_usec = (suseconds_t) (rusage.user_time % 1'000'000'000 / 1'000);
+        usage->ru_stime.tv_sec = (time_t) (rusage.system_time / 1'000'000'000);
+        usage->ru_stime.tv_usec = (suseconds_t) (rusage.system_time % 1'000'000'000 / 1'000);
+        return 0;
+    }
+
+    int sys_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *mask) {
+        // The kernel only writes the CPUs it supports, the rest of the set reads as clear
+        memset(mask, 0, cpusetsize);
+        return syscall3(SYSCALL_GET_AFFINITY, (syscall_int_t) pid, (syscall_int_t) cpusetsize, (syscall_int_t) mask).err;
+    }
+
+    int sys_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t *mask) {
+        return syscall3(SYSCALL_SET_AFFINITY, (syscall_int_t) pid, (syscall_int_t) cpusetsize, (syscall_int_t) mask).err;
+    }
+
 }
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <bits/ensure.h>
+#include <mlibc/tcb.hpp>
+#include <mlibc/all-sysdeps.hpp>
+#include <elysium/syscall.h>
+
+#define DEFAULT_STACK_SIZE 0x200000
+
+extern "C" void __mlibc_start_thread();
+
+extern "C" void __mlibc_enter_thread(void *entry, void *user_arg, Tcb *tcb) {
+    // Wait until the parent has published our TID
+    while(__atomic_load_n(&tcb->tid, __ATOMIC_RELAXED) == 0) mlibc::sys_futex_wait(&tcb->tid, 0, nullptr);
+
+    if(mlibc::sys_tcb_set(tcb)) __ensure(!"sys_tcb_set() failed");
+
+    tcb->invokeThreadFunc(entry, user_arg);
+
+    __atomic_store_n(&tcb->didExit, 1, __ATOMIC_RELEASE);
+    mlibc::sys_futex_wake(&tcb->didExit);
+
+    mlibc::sys_thread_exit();
+}
+
+namespace mlibc {
+
+    int sys_prepare_stack(void **stack, void *entry, void *user_arg, void *tcb, size_t *stack_size, size_t *guard_size, void **stack_base) {
+        if(*stack_size == 0) *stack_size = DEFAULT_STACK_SIZE;
+        *guard_size = 0;
+        if(*stack) {
+            *stack_base = *stack;
+        } else {
+            int err = sys_vm_map(nullptr, *stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0, stack_base);
+            if(err != 0) return err;
+        }
+
+        uintptr_t *sp = (uintptr_t *) ((uintptr_t) *stack_base + *stack_size);
+        *--sp = (uintptr_t) tcb;
+        *--sp = (uintptr_t) user_arg;
+        *--sp = (uintptr_t) entry;
+        *stack = (void *) sp;
+        return 0;
+    }
+
+    int sys_clone(void *tcb, pid_t *pid_out, void *stack) {
+        syscall_return_t ret = syscall3(SYSCALL_THREAD_CREATE, (syscall_int_t) __mlibc_start_thread, (syscall_int_t) stack, (syscall_int_t) tcb);
+        if(ret.err != 0) return ret.err;
+        *pid_out = (pid_t) ret.value;
+        return 0;
+    }
+
+    [[noreturn]] void sys_thread_exit() {
+        syscall0(SYSCALL_THREAD_EXIT);
+        __builtin_unreachable();
+    }
+
+}
\ No newline at end of file
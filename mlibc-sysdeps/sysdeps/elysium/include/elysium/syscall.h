@@ -19,6 +19,19 @@
 #define SYSCALL_CLOCK 13
 #define SYSCALL_ELIB_INPUT 14
 #define SYSCALL_FS_GETCWD 15
+#define SYSCALL_FORK 16
+#define SYSCALL_VM_MAP 17
+#define SYSCALL_VM_UNMAP 18
+#define SYSCALL_VM_PROTECT 19
+#define SYSCALL_SET_PRIORITY 20
+#define SYSCALL_FUTEX_WAIT 21
+#define SYSCALL_FUTEX_WAKE 22
+#define SYSCALL_FUTEX_REQUEUE 23
+#define SYSCALL_THREAD_CREATE 24
+#define SYSCALL_THREAD_EXIT 25
+#define SYSCALL_SET_AFFINITY 26
+#define SYSCALL_GET_AFFINITY 27
+#define SYSCALL_RUSAGE 28
 
 #ifdef __cplusplus
 extern "C" {
@@ -33,7 +46,9 @@ typedef struct {
 
 typedef enum {
     SYSCALL_CLOCK_TYPE_REALTIME,
-    SYSCALL_CLOCK_TYPE_MONOTONIC
+    SYSCALL_CLOCK_TYPE_MONOTONIC,
+    SYSCALL_CLOCK_TYPE_PROCESS_CPUTIME,
+    SYSCALL_CLOCK_TYPE_THREAD_CPUTIME
 } syscall_clock_type_t;
 
 typedef enum {
@@ -42,6 +57,26 @@ typedef enum {
     SYSCALL_CLOCK_MODE_SET
 } syscall_clock_mode_t;
 
+typedef enum {
+    SYSCALL_SCHED_POLICY_NORMAL,
+    SYSCALL_SCHED_POLICY_IDLE
+} syscall_sched_policy_t;
+
+typedef struct {
+    uint64_t seconds;
+    uint32_t nanoseconds;
+} syscall_timeout_t;
+
+typedef enum {
+    SYSCALL_RUSAGE_SCOPE_PROCESS,
+    SYSCALL_RUSAGE_SCOPE_THREAD
+} syscall_rusage_scope_t;
+
+typedef struct {
+    uint64_t user_time; /* nanoseconds */
+    uint64_t system_time; /* nanoseconds */
+} syscall_rusage_t;
+
 #ifdef __cplusplus
 }
 #endif